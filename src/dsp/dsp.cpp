@@ -0,0 +1,95 @@
+#include "dsp.hpp"
+
+#include <cmath>
+
+// both halves of a pair times a 16.16 gain, each saturated back to 16 bits
+static inline int32_t scale_pair(const int32_t pair, const int32_t gain) {
+    return dsp_pack(dsp_ssat<16>(dsp_smulwb(gain, pair)), dsp_ssat<16>(dsp_smulwt(gain, pair)));
+}
+
+void dsp_gain_q15(int16_t* buf, const uint16_t len, const int32_t gain) {
+    for(uint16_t i = 0; i < len; i += 2) {
+        dsp_store_pair(buf + i, scale_pair(dsp_load_pair(buf + i), gain));
+    }
+}
+
+void dsp_mix_q15(int16_t* dst, const int16_t* src, const uint16_t len, const int32_t gain) {
+    for(uint16_t i = 0; i < len; i += 2) {
+        dsp_store_pair(dst + i, dsp_qadd16(dsp_load_pair(dst + i), scale_pair(dsp_load_pair(src + i), gain)));
+    }
+}
+
+void dsp_add_q15(int16_t* dst, const int16_t* src, const uint16_t len) {
+    for(uint16_t i = 0; i < len; i += 2) {
+        dsp_store_pair(dst + i, dsp_qadd16(dsp_load_pair(dst + i), dsp_load_pair(src + i)));
+    }
+}
+
+int64_t dsp_dot_q15(const int16_t* a, const int16_t* b, const uint16_t len) {
+    int64_t acc = 0;
+    for(uint16_t i = 0; i < len; i += 2) {
+        acc = dsp_smlald(dsp_load_pair(a + i), dsp_load_pair(b + i), acc);
+    }
+    return acc;
+}
+
+void dsp_table_q15(int16_t* out, const uint16_t len, const int16_t* table, const uint8_t bits, uint32_t& phase, const uint32_t inc) {
+    const uint8_t index_shift = 32 - bits;
+    const uint8_t frac_shift = index_shift - DSP_INTERP_BITS;
+    constexpr int32_t one = 1 << DSP_INTERP_BITS;
+    uint32_t p = phase;
+    for(uint16_t i = 0; i < len; i++) {
+        const int32_t frac = p >> frac_shift & (one - 1);
+        // both neighbours in one load, both weights in one word, one multiply-accumulate
+        const int32_t pair = dsp_load_pair(table + (p >> index_shift));
+        const int32_t weights = dsp_pack(one - frac, frac);
+        out[i] = static_cast<int16_t>(dsp_smlad(pair, weights, one >> 1) >> DSP_INTERP_BITS);
+        p += inc;
+    }
+    phase = p;
+}
+
+void dsp_float_to_q15(int16_t* out, const float* in, const uint16_t len) {
+    for(uint16_t i = 0; i < len; i++) {
+        // clamped before the conversion, out of range float to int isn't defined
+        const float s = std::fmin(std::fmax(in[i] * 32767.0f, -32768.0f), 32767.0f);
+        out[i] = static_cast<int16_t>(s);
+    }
+}
+
+static void biquad_set(DspBiquad& f, const float b0, const float b1, const float b2, const float a0, const float a1, const float a2) {
+    f.b0 = b0 / a0;
+    f.b1 = b1 / a0;
+    f.b2 = b2 / a0;
+    f.a1 = a1 / a0;
+    f.a2 = a2 / a0;
+}
+
+void dsp_biquad_lowpass(DspBiquad& f, const float sample_rate, const float cutoff_hz, const float q) {
+    const float w0 = 2.0f * static_cast<float>(M_PI) * cutoff_hz / sample_rate;
+    const float cos_w0 = std::cos(w0);
+    const float alpha = std::sin(w0) / (2.0f * q);
+    biquad_set(f, (1.0f - cos_w0) / 2, 1.0f - cos_w0, (1.0f - cos_w0) / 2, 1.0f + alpha, -2.0f * cos_w0, 1.0f - alpha);
+}
+
+void dsp_biquad_highpass(DspBiquad& f, const float sample_rate, const float cutoff_hz, const float q) {
+    const float w0 = 2.0f * static_cast<float>(M_PI) * cutoff_hz / sample_rate;
+    const float cos_w0 = std::cos(w0);
+    const float alpha = std::sin(w0) / (2.0f * q);
+    biquad_set(f, (1.0f + cos_w0) / 2, -(1.0f + cos_w0), (1.0f + cos_w0) / 2, 1.0f + alpha, -2.0f * cos_w0, 1.0f - alpha);
+}
+
+void dsp_biquad(DspBiquad& f, float* buf, const uint16_t len) {
+    // state in registers for the block
+    float z1 = f.z1;
+    float z2 = f.z2;
+    for(uint16_t i = 0; i < len; i++) {
+        const float x = buf[i];
+        const float y = f.b0 * x + z1;
+        z1 = f.b1 * x - f.a1 * y + z2;
+        z2 = f.b2 * x - f.a2 * y;
+        buf[i] = y;
+    }
+    f.z1 = z1;
+    f.z2 = z2;
+}
@@ -0,0 +1,38 @@
+// block kernels for audio inner loops. q15 buffers (int16_t, like audio_block_t) go two samples
+// a word through the m7's packed instructions (intrinsics.hpp), float ones are left to the fpu.
+// lengths of q15 buffers must be even, which every audio block is
+
+#pragma once
+
+#include <cstdint>
+#include "dsp/intrinsics.hpp"
+
+#define DSP_GAIN_UNITY 65536 // gains are 16.16 fixed point
+#define DSP_INTERP_BITS 14 // table lookups interpolate with this many fraction bits
+
+// buf *= gain, saturated
+void dsp_gain_q15(int16_t* buf, uint16_t len, int32_t gain);
+// dst += src * gain, saturated
+void dsp_mix_q15(int16_t* dst, const int16_t* src, uint16_t len, int32_t gain);
+// dst += src, saturated
+void dsp_add_q15(int16_t* dst, const int16_t* src, uint16_t len);
+// sum of a[i] * b[i] (q30), doesn't overflow for any length we'd use
+int64_t dsp_dot_q15(const int16_t* a, const int16_t* b, uint16_t len);
+
+// out[i] = table at phase, linearly interpolated, phase += inc. the table has 2^bits entries plus
+// a copy of the first one at the end, and a full cycle is the whole 32 bit phase
+void dsp_table_q15(int16_t* out, uint16_t len, const int16_t* table, uint8_t bits, uint32_t& phase, uint32_t inc);
+
+// float -1..1 to q15, saturated
+void dsp_float_to_q15(int16_t* out, const float* in, uint16_t len);
+
+// transposed direct form 2, float (the m7 has a single precision fpu, q15 biquads are too noisy)
+struct DspBiquad {
+    float b0, b1, b2, a1, a2; // a0 normalised to 1
+    float z1, z2;
+};
+
+// rbj cookbook coefficients, keep the state
+void dsp_biquad_lowpass(DspBiquad& f, float sample_rate, float cutoff_hz, float q);
+void dsp_biquad_highpass(DspBiquad& f, float sample_rate, float cutoff_hz, float q);
+void dsp_biquad(DspBiquad& f, float* buf, uint16_t len);
@@ -0,0 +1,217 @@
+#include "dsp_selftest.hpp"
+
+#include <cmath>
+#include <cstring>
+#include "dsp/dsp.hpp"
+
+#define SELFTEST_MAX_LEN 128 // an audio block
+#define SELFTEST_TABLE_BITS 12 // largest table tried
+#define SELFTEST_BIQUAD_ERROR 1e-3 // float against double, over a block
+
+// the kernels one sample at a time, on the portable wrappers or on nothing at all
+namespace dsp_ref {
+
+static int16_t scale(const int16_t x, const int32_t gain) {
+    return static_cast<int16_t>(ssat<16>(static_cast<int32_t>(static_cast<int64_t>(gain) * x >> 16)));
+}
+
+static void gain_q15(int16_t* buf, const uint16_t len, const int32_t gain) {
+    for(uint16_t i = 0; i < len; i++) buf[i] = scale(buf[i], gain);
+}
+
+static void mix_q15(int16_t* dst, const int16_t* src, const uint16_t len, const int32_t gain) {
+    for(uint16_t i = 0; i < len; i++) dst[i] = static_cast<int16_t>(ssat<16>(dst[i] + scale(src[i], gain)));
+}
+
+static void add_q15(int16_t* dst, const int16_t* src, const uint16_t len) {
+    for(uint16_t i = 0; i < len; i++) dst[i] = static_cast<int16_t>(ssat<16>(dst[i] + src[i]));
+}
+
+static int64_t dot_q15(const int16_t* a, const int16_t* b, const uint16_t len) {
+    int64_t acc = 0;
+    for(uint16_t i = 0; i < len; i++) acc += static_cast<int32_t>(a[i]) * b[i];
+    return acc;
+}
+
+static void table_q15(int16_t* out, const uint16_t len, const int16_t* table, const uint8_t bits, uint32_t& phase, const uint32_t inc) {
+    constexpr int32_t one = 1 << DSP_INTERP_BITS;
+    for(uint16_t i = 0; i < len; i++) {
+        const uint32_t index = phase >> (32 - bits);
+        const int32_t frac = phase >> (32 - bits - DSP_INTERP_BITS) & (one - 1);
+        out[i] = static_cast<int16_t>((table[index] * (one - frac) + table[index + 1] * frac + one / 2) >> DSP_INTERP_BITS);
+        phase += inc;
+    }
+}
+
+static void float_to_q15(int16_t* out, const float* in, const uint16_t len) {
+    for(uint16_t i = 0; i < len; i++) {
+        const float s = in[i] * 32767.0f;
+        out[i] = s >= 32767.0f ? 32767 : s <= -32768.0f ? -32768 : static_cast<int16_t>(s);
+    }
+}
+
+// direct form 1 in double, from rest
+static void biquad(const DspBiquad& f, const float* in, double* out, const uint16_t len) {
+    double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+    for(uint16_t i = 0; i < len; i++) {
+        const double y = f.b0 * in[i] + f.b1 * x1 + f.b2 * x2 - f.a1 * y1 - f.a2 * y2;
+        x2 = x1;
+        x1 = in[i];
+        y2 = y1;
+        y1 = y;
+        out[i] = y;
+    }
+}
+
+}
+
+namespace {
+
+// xorshift, so the device and the host see the same inputs for a seed
+struct Rng {
+    uint32_t s;
+
+    uint32_t next() {
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        return s;
+    }
+
+    uint32_t below(const uint32_t n) { return next() % n; }
+
+    // mostly anything, sometimes where saturation and wraparound happen
+    int16_t sample() {
+        static constexpr int16_t edges[] = { INT16_MIN, INT16_MIN + 1, -1, 0, 1, INT16_MAX };
+        if(below(4) == 0) return edges[below(sizeof(edges) / sizeof(edges[0]))];
+        return static_cast<int16_t>(next());
+    }
+
+    int32_t word() {
+        switch(below(8)) {
+            case 0:
+                return below(2) == 0 ? INT32_MIN : INT32_MAX;
+            case 1:
+            case 2:
+                return dsp_ref::pack(sample(), sample());
+            default:
+                return static_cast<int32_t>(next());
+        }
+    }
+
+    float unit() {
+        return static_cast<float>(next()) / static_cast<float>(UINT32_MAX) * 2.0f - 1.0f;
+    }
+};
+
+struct Checker {
+    DspSelftestResult r = { 0, 0, nullptr };
+
+    void check(const bool ok, const char* what) {
+        r.checks++;
+        if(ok) return;
+        r.failures++;
+        if(r.first_failure == nullptr) r.first_failure = what;
+    }
+};
+
+}
+
+static void wrappers(Rng& rng, Checker& c) {
+    const int32_t a = rng.word();
+    const int32_t b = rng.word();
+    const int32_t acc = rng.word();
+    const int64_t acc64 = static_cast<int64_t>(static_cast<uint64_t>(rng.word()) << 32 | static_cast<uint32_t>(rng.word()));
+    c.check(dsp_ssat<16>(a) == dsp_ref::ssat<16>(a), "ssat<16>");
+    c.check(dsp_ssat<8>(a) == dsp_ref::ssat<8>(a), "ssat<8>");
+    c.check(dsp_qadd(a, b) == dsp_ref::qadd(a, b), "qadd");
+    c.check(dsp_qadd16(a, b) == dsp_ref::qadd16(a, b), "qadd16");
+    c.check(dsp_qsub16(a, b) == dsp_ref::qsub16(a, b), "qsub16");
+    c.check(dsp_smlad(a, b, acc) == dsp_ref::smlad(a, b, acc), "smlad");
+    c.check(dsp_smlald(a, b, acc64) == dsp_ref::smlald(a, b, acc64), "smlald");
+    c.check(dsp_smulwb(a, b) == dsp_ref::smulwb(a, b), "smulwb");
+    c.check(dsp_smulwt(a, b) == dsp_ref::smulwt(a, b), "smulwt");
+    c.check(dsp_pack(a, b) == dsp_ref::pack(a, b), "pack");
+}
+
+static void kernels(Rng& rng, Checker& c) {
+    // +1 so the block can start off a word boundary, the m7 loads pairs unaligned
+    static int16_t a[SELFTEST_MAX_LEN + 1], b[SELFTEST_MAX_LEN + 1], want[SELFTEST_MAX_LEN + 1];
+    static int16_t table[(1 << SELFTEST_TABLE_BITS) + 1];
+    static float f[SELFTEST_MAX_LEN];
+    static double want_f[SELFTEST_MAX_LEN];
+
+    const uint16_t len = 2 * rng.below(SELFTEST_MAX_LEN / 2 + 1);
+    const uint8_t offset = rng.below(2);
+    int16_t* x = a + offset;
+    int16_t* y = b + offset;
+    const auto fill = [&] {
+        for(uint16_t i = 0; i < len; i++) {
+            x[i] = rng.sample();
+            y[i] = rng.sample();
+        }
+    };
+    const auto same = [&](const int16_t* got) { return memcmp(got, want, len * sizeof(int16_t)) == 0; };
+    // usually a sensible gain, sometimes anything
+    const int32_t gain = rng.below(4) == 0 ? rng.word() : static_cast<int32_t>(rng.below(8 * DSP_GAIN_UNITY)) - 4 * DSP_GAIN_UNITY;
+
+    fill();
+    memcpy(want, x, len * sizeof(int16_t));
+    dsp_gain_q15(x, len, gain);
+    dsp_ref::gain_q15(want, len, gain);
+    c.check(same(x), "gain_q15");
+
+    fill();
+    memcpy(want, x, len * sizeof(int16_t));
+    dsp_mix_q15(x, y, len, gain);
+    dsp_ref::mix_q15(want, y, len, gain);
+    c.check(same(x), "mix_q15");
+
+    fill();
+    memcpy(want, x, len * sizeof(int16_t));
+    dsp_add_q15(x, y, len);
+    dsp_ref::add_q15(want, y, len);
+    c.check(same(x), "add_q15");
+
+    fill();
+    c.check(dsp_dot_q15(x, y, len) == dsp_ref::dot_q15(x, y, len), "dot_q15");
+
+    const uint8_t bits = 4 + rng.below(SELFTEST_TABLE_BITS - 3);
+    for(uint16_t i = 0; i <= 1 << bits; i++) table[i] = rng.sample();
+    uint32_t phase = rng.next();
+    uint32_t want_phase = phase;
+    const uint32_t inc = rng.next();
+    dsp_table_q15(x, len, table, bits, phase, inc);
+    dsp_ref::table_q15(want, len, table, bits, want_phase, inc);
+    c.check(same(x) && phase == want_phase, "table_q15");
+
+    for(uint16_t i = 0; i < len; i++) {
+        // mostly in range, some clipping and the odd value far out
+        f[i] = rng.below(16) == 0 ? rng.unit() * 1e6f : rng.unit() * 1.25f;
+    }
+    dsp_float_to_q15(x, f, len);
+    dsp_ref::float_to_q15(want, f, len);
+    c.check(same(x), "float_to_q15");
+
+    DspBiquad q = {};
+    const float cutoff = 100.0f + rng.below(10000);
+    const float res = 0.5f + rng.below(150) / 100.0f;
+    if(rng.below(2) == 0) dsp_biquad_lowpass(q, 44100.0f, cutoff, res);
+    else dsp_biquad_highpass(q, 44100.0f, cutoff, res);
+    for(uint16_t i = 0; i < len; i++) f[i] = rng.unit();
+    dsp_ref::biquad(q, f, want_f, len);
+    dsp_biquad(q, f, len);
+    bool close = true;
+    for(uint16_t i = 0; i < len; i++) close = close && std::fabs(f[i] - want_f[i]) < SELFTEST_BIQUAD_ERROR;
+    c.check(close, "biquad");
+}
+
+DspSelftestResult dsp_selftest(const uint32_t seed, const uint32_t rounds) {
+    Rng rng = { seed == 0 ? 1 : seed }; // xorshift never leaves 0
+    Checker c;
+    for(uint32_t i = 0; i < rounds; i++) {
+        wrappers(rng, c);
+        kernels(rng, c);
+    }
+    return c.r;
+}
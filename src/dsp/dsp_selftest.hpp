@@ -0,0 +1,16 @@
+// checks every wrapper in intrinsics.hpp and every kernel in dsp.hpp against dsp_ref on random
+// inputs, with the edge values (full scale, -1, 0) mixed in. on the teensy that's the asm against
+// the portable c++, on the host it's the kernels against a plain one sample at a time version.
+// nothing teensy specific, tools/dsp_test.cpp runs it on linux (or under qemu-arm)
+
+#pragma once
+
+#include <cstdint>
+
+struct DspSelftestResult {
+    uint32_t checks;
+    uint32_t failures;
+    const char* first_failure; // what didn't match first, nullptr if everything did
+};
+
+DspSelftestResult dsp_selftest(uint32_t seed, uint32_t rounds);
@@ -0,0 +1,161 @@
+// the cortex-m7 dsp instructions the kernels are built on, one function each. on the teensy
+// they're one instruction (inline asm, like the audio library's dspinst.h, so there's no cmsis
+// header to depend on). anywhere else they're the plain c++ in dsp_ref, which gives the same
+// bits, saturation and wraparound included, so the host build of a kernel computes exactly what
+// the teensy does
+//
+// "pair" is two q15 samples in one word, the first (lower address) in the bottom half
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__ARM_FEATURE_DSP) && !defined(DSP_PORTABLE)
+#define DSP_SIMD 1
+#endif
+
+// two samples as one word, p must be readable for 4 bytes (m7 doesn't mind unaligned)
+inline int32_t dsp_load_pair(const int16_t* p) {
+    int32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline void dsp_store_pair(int16_t* p, const int32_t v) {
+    memcpy(p, &v, 4);
+}
+
+// the portable versions, always compiled so the teensy can check its asm against them
+// (dsp_selftest.hpp). same names without the prefix
+namespace dsp_ref {
+
+template<uint8_t Bits>
+inline int32_t ssat(const int32_t v) {
+    constexpr int32_t max = (1 << (Bits - 1)) - 1;
+    constexpr int32_t min = -(1 << (Bits - 1));
+    return v > max ? max : v < min ? min : v;
+}
+
+inline int32_t qadd(const int32_t a, const int32_t b) {
+    const int64_t s = static_cast<int64_t>(a) + b;
+    return s > INT32_MAX ? INT32_MAX : s < INT32_MIN ? INT32_MIN : static_cast<int32_t>(s);
+}
+
+inline int16_t bottom(const int32_t v) { return static_cast<int16_t>(v); }
+inline int16_t top(const int32_t v) { return static_cast<int16_t>(static_cast<uint32_t>(v) >> 16); }
+
+inline int32_t pack(const int32_t lo, const int32_t hi) {
+    return static_cast<int32_t>((static_cast<uint32_t>(lo) & 0xFFFF) | static_cast<uint32_t>(hi) << 16);
+}
+
+inline int32_t qadd16(const int32_t a, const int32_t b) {
+    return pack(ssat<16>(bottom(a) + bottom(b)), ssat<16>(top(a) + top(b)));
+}
+
+inline int32_t qsub16(const int32_t a, const int32_t b) {
+    return pack(ssat<16>(bottom(a) - bottom(b)), ssat<16>(top(a) - top(b)));
+}
+
+inline int32_t smlad(const int32_t a, const int32_t b, const int32_t acc) {
+    // unsigned so the wraparound is defined, like the instruction's
+    return static_cast<int32_t>(static_cast<uint32_t>(acc)
+        + static_cast<uint32_t>(bottom(a) * bottom(b))
+        + static_cast<uint32_t>(top(a) * top(b)));
+}
+
+inline int64_t smlald(const int32_t a, const int32_t b, const int64_t acc) {
+    return static_cast<int64_t>(static_cast<uint64_t>(acc)
+        + static_cast<uint64_t>(static_cast<int64_t>(bottom(a) * bottom(b)))
+        + static_cast<uint64_t>(static_cast<int64_t>(top(a) * top(b))));
+}
+
+inline int32_t smulwb(const int32_t a, const int32_t b) {
+    return static_cast<int32_t>(static_cast<int64_t>(a) * bottom(b) >> 16);
+}
+
+inline int32_t smulwt(const int32_t a, const int32_t b) {
+    return static_cast<int32_t>(static_cast<int64_t>(a) * top(b) >> 16);
+}
+
+}
+
+#ifdef DSP_SIMD
+
+// saturate to a signed bits-wide value
+template<uint8_t Bits>
+inline int32_t dsp_ssat(const int32_t v) {
+    int32_t out;
+    asm("ssat %0, %1, %2" : "=r"(out) : "I"(Bits), "r"(v));
+    return out;
+}
+
+// 32 bit saturating add
+inline int32_t dsp_qadd(const int32_t a, const int32_t b) {
+    int32_t out;
+    asm("qadd %0, %1, %2" : "=r"(out) : "r"(a), "r"(b));
+    return out;
+}
+
+// both halves added, each saturated to 16 bits
+inline int32_t dsp_qadd16(const int32_t a, const int32_t b) {
+    int32_t out;
+    asm("qadd16 %0, %1, %2" : "=r"(out) : "r"(a), "r"(b));
+    return out;
+}
+
+inline int32_t dsp_qsub16(const int32_t a, const int32_t b) {
+    int32_t out;
+    asm("qsub16 %0, %1, %2" : "=r"(out) : "r"(a), "r"(b));
+    return out;
+}
+
+// acc + a.bottom * b.bottom + a.top * b.top, wraps at 32 bits
+inline int32_t dsp_smlad(const int32_t a, const int32_t b, const int32_t acc) {
+    int32_t out;
+    asm("smlad %0, %1, %2, %3" : "=r"(out) : "r"(a), "r"(b), "r"(acc));
+    return out;
+}
+
+// same into 64 bits
+inline int64_t dsp_smlald(const int32_t a, const int32_t b, const int64_t acc) {
+    uint32_t lo = acc;
+    int32_t hi = acc >> 32;
+    asm("smlald %0, %1, %2, %3" : "+r"(lo), "+r"(hi) : "r"(a), "r"(b));
+    return static_cast<int64_t>(static_cast<uint64_t>(hi) << 32 | lo);
+}
+
+// (a * b.bottom) >> 16 and (a * b.top) >> 16
+inline int32_t dsp_smulwb(const int32_t a, const int32_t b) {
+    int32_t out;
+    asm("smulwb %0, %1, %2" : "=r"(out) : "r"(a), "r"(b));
+    return out;
+}
+
+inline int32_t dsp_smulwt(const int32_t a, const int32_t b) {
+    int32_t out;
+    asm("smulwt %0, %1, %2" : "=r"(out) : "r"(a), "r"(b));
+    return out;
+}
+
+// bottom half of lo, bottom half of hi on top
+inline int32_t dsp_pack(const int32_t lo, const int32_t hi) {
+    int32_t out;
+    asm("pkhbt %0, %1, %2, lsl #16" : "=r"(out) : "r"(lo), "r"(hi));
+    return out;
+}
+
+#else
+
+template<uint8_t Bits>
+inline int32_t dsp_ssat(const int32_t v) { return dsp_ref::ssat<Bits>(v); }
+inline int32_t dsp_qadd(const int32_t a, const int32_t b) { return dsp_ref::qadd(a, b); }
+inline int32_t dsp_qadd16(const int32_t a, const int32_t b) { return dsp_ref::qadd16(a, b); }
+inline int32_t dsp_qsub16(const int32_t a, const int32_t b) { return dsp_ref::qsub16(a, b); }
+inline int32_t dsp_smlad(const int32_t a, const int32_t b, const int32_t acc) { return dsp_ref::smlad(a, b, acc); }
+inline int64_t dsp_smlald(const int32_t a, const int32_t b, const int64_t acc) { return dsp_ref::smlald(a, b, acc); }
+inline int32_t dsp_smulwb(const int32_t a, const int32_t b) { return dsp_ref::smulwb(a, b); }
+inline int32_t dsp_smulwt(const int32_t a, const int32_t b) { return dsp_ref::smulwt(a, b); }
+inline int32_t dsp_pack(const int32_t lo, const int32_t hi) { return dsp_ref::pack(lo, hi); }
+
+#endif
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <cstdint>
-#include <util/event.hpp>
+#include <util/deferred_event.hpp>
 
 #undef KEY_MENU // this is defined by teensyduino in keylayouts.h
 
@@ -15,4 +15,5 @@ enum CtrlKey : uint8_t {
     KEY_RIGHT_4 = 8
 };
 
-inline auto ctrl_keys_evt = BubblingEvent<const CtrlKey>();
\ No newline at end of file
+// emitted from the kscan path, so listeners run on the event pump instead
+inline auto ctrl_keys_evt = DeferredBubblingEvent<const CtrlKey>();
\ No newline at end of file
@@ -1,5 +1,13 @@
 #include "encoder.hpp"
 
+static Encoder* const encoders[] = { &enc_0, &enc_1, &enc_2, &enc_3, &enc_ctrl };
+
+void encoder_poll_next() {
+    static uint8_t next = 0;
+    encoders[next]->poll();
+    next = (next + 1) % (sizeof(encoders) / sizeof(encoders[0]));
+}
+
 void encoder_init() {
     enc_0.init();
     enc_1.init();
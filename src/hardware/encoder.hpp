@@ -4,6 +4,9 @@
 #include "../util/thread.hpp"
 #include "i2c_mp.hpp"
 #include "util/event.hpp"
+#include "util/deferred_event.hpp"
+#include "input/input_stream.hpp"
+#include "scheduler/executive.hpp"
 
 #define ENCODER_DEBUG
 
@@ -22,7 +25,8 @@ private:
     int16_t step_count = 0;
     uint16_t prev_angle = 0;
 
-    using EncoderCallback = void (*)(int16_t incs);
+    // can capture, stored inline like the event listeners
+    using EncoderCallback = TeensyTimerTool::stdext::inplace_function<void(int16_t incs), EVENT_LISTENER_STORAGE>;
     EncoderCallback callback;
 
     [[nodiscard]] uint8_t read_register(uint8_t reg) const {
@@ -66,27 +70,31 @@ private:
 
     [[noreturn]] void thread_fn() {
         while(true) {
-            auto angle = read_angle();
-            int16_t diff = angle - prev_angle;
-            if(diff > 2048) {
-                diff -= 4096;
-            } else if(diff < -2048) {
-                diff += 4096;
-            }
-            step_count += diff;
-            prev_angle = angle;
-            int16_t incs = step_count / steps_per_inc;
-            if(incs != 0) {
-                step_count %= steps_per_inc;
-                callback(incs);
-            }
-
+            poll();
             threads.delay(2); // ??
         }
     }
     friend class Thread<Encoder>;
 
 public:
+    // read the angle once and call the callback if it moved far enough
+    void poll() {
+        auto angle = read_angle();
+        int16_t diff = angle - prev_angle;
+        if(diff > 2048) {
+            diff -= 4096;
+        } else if(diff < -2048) {
+            diff += 4096;
+        }
+        step_count += diff;
+        prev_angle = angle;
+        int16_t incs = step_count / steps_per_inc;
+        if(incs != 0) {
+            step_count %= steps_per_inc;
+            callback(incs);
+        }
+    }
+
     Encoder(uint8_t index, EncoderCallback cb) : index(index), callback(cb) {}
     Encoder(uint8_t index, uint8_t incs_per_rev, EncoderCallback cb) : index(index), callback(cb) {
         set_steps_per_inc(incs_per_rev);
@@ -102,7 +110,9 @@ public:
 #ifdef ENCODER_DEBUG
         Serial.printf("encoder %d: init\n", index);
 #endif
+#ifndef CYCLIC_EXECUTIVE
         thread_init();
+#endif
 
         auto status = read_register(AS5600_STATUS);
 #ifdef ENCODER_DEBUG
@@ -127,23 +137,26 @@ public:
     }
 };
 
+// turns are coalesced in the input stream until it's drained
 inline auto enc_0 = Encoder(0, [](int16_t incs) {
-    Serial.printf("enc 0: %d\n", incs);
+    input_stream.push_encoder(0, incs, micros());
 });
 inline auto enc_1 = Encoder(1, [](int16_t incs) {
-    Serial.printf("enc 1: %d\n", incs);
+    input_stream.push_encoder(1, incs, micros());
 });
 inline auto enc_2 = Encoder(2, [](int16_t incs) {
-    Serial.printf("enc 2: %d\n", incs);
+    input_stream.push_encoder(2, incs, micros());
 });
 inline auto enc_3 = Encoder(3, [](int16_t incs) {
-    Serial.printf("enc 3: %d\n", incs);
+    input_stream.push_encoder(3, incs, micros());
 });
 
-inline auto enc_ctrl_evt = DispatcherEvent<int16_t>();
+inline auto enc_ctrl_evt = DeferredDispatcherEvent<int16_t>();
 inline auto enc_ctrl = Encoder(4, 24, [](int16_t incs) {
-    Serial.printf("enc ctrl: %d\n", incs);
+    input_stream.push_encoder(4, incs, micros());
     enc_ctrl_evt.emit(incs);
 });
 
-void encoder_init();
\ No newline at end of file
+void encoder_init();
+// poll the next encoder, round robin (for the cyclic executive)
+void encoder_poll_next();
\ No newline at end of file
@@ -1,51 +1,859 @@
 #include "midi.hpp"
 #include "usb_names.h"
+#include <atomic>
 #include <TeensyThreads.h>
 #define MIDI_INTERFACE 2 // so ide knows midi is enabled
 #include <usb_midi.h>
+#include <usb_dev.h>
 #include <kscan/kscan_gpio_matrix.hpp>
 #include <util/log.hpp>
+#include <util/spsc_queue.hpp>
+#include "midi/note_map.hpp"
+#include "midi/din_out.hpp"
+#include "midi/arp.hpp"
+#include "midi/din_in.hpp"
+#include "util/latency.hpp"
+#include "scheduler/executive.hpp"
 
 namespace Midi {
-    constexpr uint8_t channel = 1;
     auto l = new Log<true>("midi");
 
-    void init() {
-        // keep midi send buffer empty
-        threads.addThread([] {
-            while(true) {
-                usbMIDI.read();
-                threads.delay(10);
+    // usb midi event packets are 4 bytes, and a usb packet is 64 bytes at full speed or 512 at high speed
+    constexpr uint8_t EVENTS_PER_PACKET_12 = 64 / 4;
+    constexpr uint8_t EVENTS_PER_PACKET_480 = 512 / 4;
+
+    // a write that takes longer than this means the host isn't polling fast enough
+    constexpr uint32_t STALL_US = 500;
+
+    // usb midi event packet: cable number and code index in the low byte, then the midi bytes
+    constexpr uint32_t usb_packet(const uint8_t status, const uint8_t data1, const uint8_t data2) {
+        // for channel messages the code index is just the high nibble of the status
+        return status >> 4 | status << 8 | data1 << 16 | static_cast<uint32_t>(data2) << 24;
+    }
+
+    // the key path (timer service thread) pushes, the sender thread pops, so the key path
+    // never waits on usb
+    static SpscQueue<Event, MIDI_QUEUE_LEN> out_queue;
+    // same for expression from the event pump
+    static SpscQueue<Event, MIDI_EXPR_QUEUE_LEN> expr_queue;
+
+    struct SequencedEvent {
+        Event e;
+        uint32_t due_us;
+    };
+    // and for the arpeggiator's timer interrupt
+    static SpscQueue<SequencedEvent, MIDI_SEQ_QUEUE_LEN> seq_queue;
+
+    // slots only note offs can use. the key path only owes a note off for a note on that made it
+    // into the queue (see sounding), so there can never be more owed than there are keys
+    constexpr size_t NOTE_OFF_RESERVE = NOTE_KEYS_LEN;
+    // and play() gets its own, so playback can't use up the keys' (or the other way around). it
+    // stops taking note ons while it owes this many note offs
+    constexpr size_t PLAY_NOTE_OFF_RESERVE = MIDI_PLAY_MAX_SOUNDING;
+    static_assert(NOTE_OFF_RESERVE + PLAY_NOTE_OFF_RESERVE < MIDI_QUEUE_LEN, "midi queue can't hold every note off we might owe");
+
+    // the note each key's queued note on played (NOTE_UNMAPPED if none), so the note off matches it
+    // even if the note map changed in between. only touched by the key path
+    static NoteMapping sounding[NOTE_KEYS_LEN];
+    // play()'s notes that are owed a note off, by channel, and how many. only touched by the key path
+    static uint32_t play_sounding[16][4];
+    static uint8_t play_owed = 0;
+
+    // member channels by key index, only touched by the key path
+    static MpeChannelAllocator mpe;
+    // pending set_mpe(): 0x10000 | (bend range << 8) | members
+    static std::atomic<uint32_t> mpe_request{0};
+    static std::atomic<uint32_t> last_note{0};
+    static std::atomic<bool> mpe_on{false};
+    static uint32_t note_ons = 0;
+
+
+    // din gets the same events as usb, written from the sender thread. like the queue, it keeps
+    // room for every note off we might owe (3 bytes each without running status)
+    static DinOut<HardwareSerial, MIDI_DIN_BUFFER_LEN, (NOTE_OFF_RESERVE + PLAY_NOTE_OFF_RESERVE) * 3> din(MIDI_DIN_SERIAL);
+    static DinIn<HardwareSerial> din_in(MIDI_DIN_SERIAL);
+
+    static MidiRouter router;
+    static Threads::Mutex router_mutex; // writers only, lookups don't lock
+
+    // traffic between ports is read and written on the sender thread, so these only decouple
+    // reading from writing, and let local events go first
+    struct Forward {
+        uint8_t status;
+        uint8_t data1;
+        uint8_t data2;
+        MidiPort from;
+        uint8_t to; // port_bits
+        uint32_t ts;
+    };
+    static SpscQueue<Forward, MIDI_FORWARD_QUEUE_LEN> forward_queue;
+
+    struct BulkChunk {
+        uint8_t data[DIN_SYSEX_CHUNK_LEN];
+        uint8_t len;
+        bool last;
+        MidiPort from;
+        uint8_t to;
+        uint32_t ts;
+    };
+    static SpscQueue<BulkChunk, MIDI_BULK_QUEUE_LEN> bulk_queue;
+    // sysex bytes waiting for a full usb packet (3 bytes) across pieces
+    static uint8_t sysex_carry[2];
+    static uint8_t sysex_carry_len = 0;
+    // port_bits of where a sysex is partway out. nothing but realtime can go in between, so the
+    // rest of the traffic to those ports waits for it
+    static uint8_t sysex_open = 0;
+    static uint32_t sysex_last_us = 0; // when the last piece went out
+    static uint8_t sysex_cut_from = 0; // port_bits of sources whose sysex we cut, see cut_sysex()
+
+    struct SysExOut {
+        uint8_t data[MIDI_SYSEX_OUT_LEN];
+        uint8_t len;
+    };
+    static SpscQueue<SysExOut, MIDI_SYSEX_OUT_QUEUE_LEN> sysex_out_queue;
+
+    // 31.25 kbaud, 10 bits a byte
+    constexpr uint32_t DIN_BYTE_US = 320;
+
+    // packets are built here and handed to the usb stack together, see commit()
+    static uint32_t tx[MIDI_TX_BATCH_LEN];
+    static uint8_t tx_len = 0;
+#ifdef LATENCY_BENCH
+    static uint8_t latency_uncommitted = 0; // note ons sitting in tx
+#endif
+
+    // events written since the last flush, for counting transactions (only touched by the sender).
+    // the start of frame handler can flush between commits without us knowing, so this is only a
+    // packet boundary right after flush_usb()
+    static uint8_t pending = 0;
+    static Stats _stats = {};
+
+    static uint8_t events_per_packet() {
+        return usb_high_speed ? EVENTS_PER_PACKET_480 : EVENTS_PER_PACKET_12;
+    }
+
+    // producer side
+
+#ifdef LATENCY_BENCH
+    static_assert(LATENCY_IN_FLIGHT_LEN >= MIDI_QUEUE_LEN + MIDI_TX_BATCH_LEN, "latency samples can't keep up with the queue");
+#endif
+
+    // owed_off: a note off for a note on that made it into the queue, which can use the reserves.
+    // key is only for the latency bench, which note on this is
+    static bool queue_event(const Event& e, const bool owed_off, [[maybe_unused]] const uint8_t key) {
+        const size_t depth = out_queue.size();
+        // everything else has to leave room for the note offs we might still owe
+        if(!owed_off && depth >= MIDI_QUEUE_LEN - NOTE_OFF_RESERVE - PLAY_NOTE_OFF_RESERVE) {
+            _stats.dropped++;
+            return false;
+        }
+#ifdef LATENCY_BENCH
+        // before the push, so the sender can't get to the note on first. the push can't fail now,
+        // the queue only gets emptier from here
+        if(e.type == EventType::note_on) latency_queued(key);
+#endif
+        if(!out_queue.push(e)) {
+            // can't happen for owed note offs, see NOTE_OFF_RESERVE
+            _stats.dropped++;
+            return false;
+        }
+        if(depth + 1 > _stats.max_depth) _stats.max_depth = depth + 1;
+        return true;
+    }
+
+    // the key path's own note offs are always owed (it only sends them for what's in sounding)
+    static bool enqueue(const Event& e, const uint8_t key = LATENCY_NO_KEY) {
+        return queue_event(e, e.type == EventType::note_off, key);
+    }
+
+    void set_mpe(const uint8_t members, const uint8_t bend_range) {
+        mpe_request.store(0x10000 | bend_range << 8 | std::min<uint8_t>(members, MPE_MAX_MEMBERS), std::memory_order_release);
+    }
+
+    bool mpe_enabled() {
+        return mpe_on.load(std::memory_order_relaxed);
+    }
+
+    uint32_t mpe_last_note() {
+        return last_note.load(std::memory_order_acquire);
+    }
+
+    // key path
+    static void apply_mpe_request() {
+        const uint32_t r = mpe_request.exchange(0, std::memory_order_acquire);
+        if(r == 0) return;
+        const uint8_t members = r & 0xFF;
+        // on the manager channel so the router has a channel to filter it by
+        if(!enqueue({ EventType::mpe_config, MPE_MANAGER_CHANNEL, members, static_cast<uint8_t>(r >> 8) })) {
+            // try again next time, unless a newer request came in
+            uint32_t expected = 0;
+            mpe_request.compare_exchange_strong(expected, r, std::memory_order_release);
+            return;
+        }
+        // notes already held keep their channels, release() ignores them
+        mpe.reset(members);
+        mpe_on.store(members > 0, std::memory_order_relaxed);
+        last_note.store(0, std::memory_order_release);
+    }
+
+    void flush() {
+        apply_mpe_request();
+        enqueue({ EventType::flush, 0, 0, 0 });
+    }
+
+    bool send_expression(const Event& e) {
+        if(expr_queue.push(e)) return true;
+        _stats.expr_dropped++;
+        return false;
+    }
+
+    bool send_sysex(const uint8_t* data, const uint8_t len) {
+        SysExOut s;
+        if(len <= MIDI_SYSEX_OUT_LEN) {
+            memcpy(s.data, data, len);
+            s.len = len;
+            if(sysex_out_queue.push(s)) return true;
+        }
+        _stats.sysex_dropped++;
+        return false;
+    }
+
+    bool play(const Event& e) {
+        if(e.type != EventType::note_on && e.type != EventType::note_off) return queue_event(e, false, LATENCY_NO_KEY);
+        auto& word = play_sounding[(e.channel - 1) & 0x0F][(e.data1 >> 5) & 3];
+        const uint32_t bit = 1ul << (e.data1 & 31);
+        if(e.type == EventType::note_off) {
+            // one for a note we never got the note on of doesn't get the reserve
+            const bool owed = word & bit;
+            if(!queue_event(e, owed, LATENCY_NO_KEY)) return false;
+            if(owed) {
+                word &= ~bit;
+                play_owed--;
             }
-        });
+            return true;
+        }
+        if(!(word & bit) && play_owed >= PLAY_NOTE_OFF_RESERVE) {
+            _stats.dropped++;
+            return false;
+        }
+        if(!queue_event(e, false, LATENCY_NO_KEY)) return false;
+        if(!(word & bit)) {
+            word |= bit;
+            play_owed++;
+        }
+        return true;
+    }
+
+    bool send_sequenced(const Event& e, const uint32_t due_us) {
+        // the arp only ever has one note sounding, so one slot is enough to never drop its note off
+        constexpr size_t SEQ_NOTE_OFF_RESERVE = 1;
+        if((e.type == EventType::note_off || seq_queue.size() < MIDI_SEQ_QUEUE_LEN - SEQ_NOTE_OFF_RESERVE)
+            && seq_queue.push({ e, due_us })) return true;
+        _stats.seq_dropped++;
+        return false;
+    }
+
+    static NoteMapping mpe_note_on(const uint8_t key, NoteMapping m, const uint8_t velocity) {
+        const auto a = mpe.allocate(key);
+        if(a.stolen) {
+            const auto s = sounding[a.stolen_owner];
+            sounding[a.stolen_owner].note = NOTE_UNMAPPED;
+            enqueue({ EventType::note_off, s.channel, s.note, 0 });
+            _stats.stolen++;
+        }
+        m.channel = a.channel;
+        // the channel might still be bent/pressed from its last note, start from the key's values
+        enqueue({ EventType::pitch_bend, m.channel, 0x00, 0x40 });
+        const uint8_t pressure = velocity >> 1;
+        enqueue({ EventType::channel_pressure, m.channel, pressure, 0 });
+        enqueue({ EventType::control_change, m.channel, 74, 64 });
+        last_note.store(++note_ons << 15 | pressure << 8 | m.channel, std::memory_order_release);
+        return m;
+    }
+
+    void velocity_handler(const uint8_t row, const uint8_t column, const uint8_t velocity, const bool pressed) {
+        const uint8_t key = row * COLS_LEN + column;
+        if(key >= NOTE_KEYS_LEN) return;
+
+        if(pressed) {
+            apply_mpe_request();
+            auto m = note_map_lookup(key);
+            if(m.note == NOTE_UNMAPPED || arp_playing_keys()) return;
+            if(mpe.member_count() > 0) m = mpe_note_on(key, m, velocity);
+            const bool queued = enqueue({ EventType::note_on, m.channel, m.note, velocity }, key);
+            if(!queued) mpe.release(m.channel, key);
+            sounding[key] = queued ? m : NoteMapping { NOTE_UNMAPPED, 0 };
+        } else if(sounding[key].note != NOTE_UNMAPPED) {
+            const auto m = sounding[key];
+            sounding[key].note = NOTE_UNMAPPED;
+            mpe.release(m.channel, key);
+            enqueue({ EventType::note_off, m.channel, m.note, 0 });
+        } else {
+            // its note on was dropped (or the key isn't mapped), so there's nothing to turn off
+            _stats.suppressed_offs++;
+        }
+    }
+
+    // sender side
+
+    static void written(const uint8_t n) {
+        pending += n;
+        while(pending >= events_per_packet()) {
+            // the usb stack sends a packet by itself as soon as it fills up
+            pending -= events_per_packet();
+            _stats.transactions++;
+        }
+    }
+
+    // hand everything built so far to the usb stack. with the usb interrupt masked its start of
+    // frame handler can't flush a partial packet halfway through, so a burst (a chord, a velocity
+    // prefix and its note on) goes out back to back instead of split across frames
+    static void commit() {
+        if(tx_len == 0) return;
+        const uint32_t start = micros();
+        NVIC_DISABLE_IRQ(IRQ_USB1);
+        for(uint8_t i = 0; i < tx_len; i++) {
+            usb_midi_write_packed(tx[i]);
+        }
+        NVIC_ENABLE_IRQ(IRQ_USB1);
+        const uint32_t now = micros();
+        if(now - start > STALL_US) {
+            _stats.stalls++;
+            if(now - start > _stats.max_stall_us) _stats.max_stall_us = now - start;
+        }
+        written(tx_len);
+        tx_len = 0;
+#ifdef LATENCY_BENCH
+        for(; latency_uncommitted > 0; latency_uncommitted--) latency_submit(now);
+#endif
+    }
+
+    // n packets that have to be committed together
+    static uint32_t* reserve(const uint8_t n) {
+        if(tx_len + n > MIDI_TX_BATCH_LEN) commit();
+        uint32_t* p = tx + tx_len;
+        tx_len += n;
+        return p;
+    }
+
+    static void flush_usb() {
+        commit();
+        if(pending == 0) return;
+        usb_midi_flush_output();
+        pending = 0;
+        _stats.transactions++;
+    }
+
+    // n packets that also have to end up in the same usb packet (a velocity prefix and its note on),
+    // so the host can't see the first without the second. once a commit has left a partial packet
+    // the start of frame handler may or may not have sent it since, so we can't know where the
+    // boundary is and flush it ourselves (a no-op if it already went, and the transaction we
+    // count is then the one the handler made). after that the batch fills packets in order from 0
+    static uint32_t* reserve_together(const uint8_t n) {
+        if(pending > 0 || tx_len % events_per_packet() + n > events_per_packet()) flush_usb();
+        return reserve(n);
+    }
+
+    static void put(const uint8_t status, const uint8_t channel, const uint8_t data1, const uint8_t data2) {
+        *reserve(1) = usb_packet(status | (channel - 1), data1, data2);
     }
 
     // send high res velocity (14 bits) with the note
     // we're only using 8 bits so this accepts a uint8_t
-    void send_note_on(const uint8_t note, const uint8_t velocity) {
-        // get the last bit and make it the 7th
-        const uint8_t lsb = (velocity & 1) << 7;
+    static void send_note_on(const uint8_t channel, const uint8_t note, const uint8_t velocity) {
+        // get the last bit and make it the top one of the 7 bit data byte
+        const uint8_t lsb = (velocity & 1) << 6;
+        // get upper 7 bits, 0 would be a note off
+        const uint8_t msb = std::max<uint8_t>(velocity >> 1, 1);
+        const uint8_t ch = channel - 1;
+
         // https://www.midi.org/midi/specifications/midi1-specifications/midi-1-addenda/high-resolution-velocity-prefix
-        usbMIDI.sendControlChange(0x58, lsb, channel);
-        // get upper 7 bits
-        const uint8_t msb = velocity >> 1;
-        usbMIDI.sendNoteOn(note, msb, channel);
+        const auto p = reserve_together(2);
+        p[0] = usb_packet(0xB0 | ch, 0x58, lsb);
+        p[1] = usb_packet(0x90 | ch, note, msb);
+        _stats.notes++;
         l->debug("midi_note_send_on: %d %d %d\n", note, msb, lsb);
     }
 
-    void send_note_off(const uint8_t note) {
-        // ideally we'd be using running status but
-        // the teensy midi library doesn't support it
-        usbMIDI.sendNoteOff(note, 0, channel);
+    static void send_note_off(const uint8_t channel, const uint8_t note) {
+        put(0x80, channel, note, 0);
+        _stats.notes++;
         l->debug("midi_note_send_off: %d\n", note);
     }
 
-    void velocity_handler(const uint8_t row, const uint8_t column, const uint8_t velocity, const bool pressed) {
-        if(pressed) {
-            send_note_on(row * COLS_LEN + column, velocity);
+    static void send_cc(const uint8_t channel, const uint8_t control, const uint8_t value) {
+        put(0xB0, channel, control, value);
+    }
+
+    static void send_rpn(const uint8_t channel, const uint8_t rpn, const uint8_t value) {
+        send_cc(channel, 101, 0);
+        send_cc(channel, 100, rpn);
+        send_cc(channel, 6, value);
+        send_cc(channel, 38, 0);
+    }
+
+    static void send_mpe_config(const uint8_t members, const uint8_t bend_range) {
+        // mpe configuration message (rpn 6) on the manager channel sets up the lower zone, and
+        // resets the members' bend range to 48
+        send_rpn(MPE_MANAGER_CHANNEL, 6, members);
+        if(members == 0 || bend_range == MPE_DEFAULT_BEND_RANGE) return;
+        for(uint8_t ch = MPE_MANAGER_CHANNEL + 1; ch <= MPE_MANAGER_CHANNEL + members; ch++) {
+            send_rpn(ch, 0, bend_range);
+        }
+    }
+
+    static void din_mpe_config(const uint8_t members, const uint8_t bend_range) {
+        const auto rpn = [](const uint8_t channel, const uint8_t rpn, const uint8_t value) {
+            din.control_change(channel, 101, 0);
+            din.control_change(channel, 100, rpn);
+            din.control_change(channel, 6, value);
+            din.control_change(channel, 38, 0);
+        };
+        rpn(MPE_MANAGER_CHANNEL, 6, members);
+        if(members == 0 || bend_range == MPE_DEFAULT_BEND_RANGE) return;
+        for(uint8_t ch = MPE_MANAGER_CHANNEL + 1; ch <= MPE_MANAGER_CHANNEL + members; ch++) {
+            rpn(ch, 0, bend_range);
+        }
+    }
+
+    // no high res velocity prefix here, at 31.25 kbaud it'd cost a millisecond per note and
+    // break running status between the notes of a chord
+    static void din_send(const Event& e) {
+        switch(e.type) {
+            case EventType::note_on:
+                din.note_on(e.channel, e.data1, std::max<uint8_t>(e.data2 >> 1, 1));
+                break;
+            case EventType::note_off:
+                din.note_off(e.channel, e.data1);
+                break;
+            case EventType::control_change:
+                din.control_change(e.channel, e.data1, e.data2);
+                break;
+            case EventType::pitch_bend:
+                din.pitch_bend(e.channel, e.data1, e.data2);
+                break;
+            case EventType::channel_pressure:
+                din.channel_pressure(e.channel, e.data1);
+                break;
+            case EventType::mpe_config:
+                din_mpe_config(e.data1, e.data2);
+                break;
+            case EventType::flush:
+                break;
+        }
+    }
+
+    // status to filter local events by, 0 for flush (always goes). mpe_config goes by its manager channel
+    static constexpr uint8_t event_status[] = {
+        0x90, // note_on
+        0x80, // note_off
+        0xB0, // control_change
+        0xE0, // pitch_bend
+        0xD0, // channel_pressure
+        0xB0, // mpe_config
+        0 // flush
+    };
+
+    static uint8_t destinations(const Event& e) {
+        const uint8_t status = event_status[static_cast<uint8_t>(e.type)];
+        return status == 0 ? port_bit(MidiPort::usb) : router.destinations(MidiPort::local, status, e.channel);
+    }
+
+    static void send(const Event& e) {
+        const uint8_t to = destinations(e);
+        if(to & port_bit(MidiPort::din)) din_send(e);
+        if(!(to & port_bit(MidiPort::usb))) return;
+        switch(e.type) {
+            case EventType::note_on:
+                send_note_on(e.channel, e.data1, e.data2);
+                break;
+            case EventType::note_off:
+                send_note_off(e.channel, e.data1);
+                break;
+            case EventType::control_change:
+                send_cc(e.channel, e.data1, e.data2);
+                break;
+            case EventType::pitch_bend:
+                put(0xE0, e.channel, e.data1, e.data2);
+                break;
+            case EventType::channel_pressure:
+                put(0xD0, e.channel, e.data1, 0);
+                break;
+            case EventType::mpe_config:
+                send_mpe_config(e.data1, e.data2);
+                break;
+            case EventType::flush:
+                flush_usb();
+                break;
+        }
+    }
+
+    // code index for system messages, by low nibble of the status
+    static constexpr uint8_t system_cin[16] = {
+        0x4, 0x2, 0x3, 0x2, 0x5, 0x5, 0x5, 0x5, // F0 (sysex, not used here), mtc, spp, song select, undefined, tune request
+        0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF // realtime
+    };
+
+    static void usb_forward(const Forward& f) {
+        const uint8_t cin = f.status < 0xF0 ? f.status >> 4 : system_cin[f.status & 0x0F];
+        *reserve(1) = cin | f.status << 8 | f.data1 << 16 | f.data2 << 24;
+    }
+
+    static void din_forward(const Forward& f) {
+        if(f.status >= 0xF8) {
+            din.realtime(f.status);
+        } else if(f.status >= 0xF0) {
+            const uint8_t bytes[3] = { f.status, f.data1, f.data2 };
+            din.raw(bytes, f.status == 0xF2 ? 3 : f.status == 0xF1 || f.status == 0xF3 ? 2 : 1);
         } else {
-            send_note_off(row * COLS_LEN + column);
+            const uint8_t type = f.status & 0xF0;
+            din.send(f.status, f.data1, f.data2, type == 0xC0 || type == 0xD0 ? 1 : 2);
+        }
+    }
+
+    // usb sysex packets carry 3 bytes (code index 4) until the last one (5, 6, 7 for 1, 2, 3 bytes)
+    static void usb_sysex(const uint8_t* data, const uint8_t len, const bool last) {
+        uint8_t bytes[3];
+        uint8_t n = 0;
+        for(uint8_t i = 0; i < sysex_carry_len; i++) bytes[n++] = sysex_carry[i];
+        sysex_carry_len = 0;
+        for(uint8_t i = 0; i < len; i++) {
+            bytes[n++] = data[i];
+            const bool end = last && i == len - 1;
+            if(n == 3 || end) {
+                const uint8_t cin = end ? 0x4 + n : 0x4;
+                *reserve(1) = cin | bytes[0] << 8 | (n > 1 ? bytes[1] : 0) << 16 | (n > 2 ? bytes[2] : 0) << 24;
+                n = 0;
+            }
+        }
+        for(uint8_t i = 0; i < n; i++) sysex_carry[sysex_carry_len++] = bytes[i];
+        if(last) sysex_open &= ~port_bit(MidiPort::usb);
+        else sysex_open |= port_bit(MidiPort::usb);
+    }
+
+    static void record_route(const MidiPort from, const uint8_t to, const uint32_t ts) {
+        const uint32_t now = micros();
+        for(uint8_t p = 0; p < MIDI_PORTS; p++) {
+            if(!(to & 1 << p)) continue;
+            // for din, plus how long what's ahead of it in the ring takes to go out
+            const uint32_t queued = p == static_cast<uint8_t>(MidiPort::din) ? din.depth() * DIN_BYTE_US : 0;
+            router.latency[static_cast<uint8_t>(from)][p].record(now - ts + queued);
+            router.routed[static_cast<uint8_t>(from)][p]++;
+        }
+    }
+
+    static void forward(const MidiPort from, const uint8_t status, const uint8_t data1, const uint8_t data2, const uint32_t ts) {
+        const uint8_t to = router.destinations(from, status, (status & 0x0F) + 1);
+        if(to == 0) return;
+        if(!forward_queue.push({ status, data1, data2, from, to, ts })) _stats.forward_dropped++;
+    }
+
+    static void forward_sysex(const MidiPort from, const uint8_t* data, const uint16_t length, const bool complete, const uint32_t ts) {
+        const uint8_t to = router.destinations(from, 0xF0, 0);
+        if(to == 0) return;
+        uint16_t offset = 0;
+        do {
+            BulkChunk c;
+            c.len = std::min<uint16_t>(length - offset, DIN_SYSEX_CHUNK_LEN);
+            memcpy(c.data, data + offset, c.len);
+            offset += c.len;
+            c.last = complete && offset == length;
+            c.from = from;
+            c.to = to;
+            c.ts = ts;
+            if(!bulk_queue.push(c)) _stats.forward_dropped++;
+        } while(offset < length);
+    }
+
+    // the next piece of a forwarded sysex, if it can go now. false leaves it queued
+    static bool send_bulk(const BulkChunk& c) {
+        // the start of one we cut (or the rest of it, which we drop)
+        if(sysex_cut_from & port_bit(c.from)) {
+            if(c.data[0] != 0xF0) return true;
+            sysex_cut_from &= ~port_bit(c.from);
+        }
+        if((c.to & port_bit(MidiPort::din)) && din.room() < c.len) return false;
+        if(c.to & port_bit(MidiPort::usb)) usb_sysex(c.data, c.len, c.last);
+        if(c.to & port_bit(MidiPort::din)) {
+            din.raw(c.data, c.len);
+            if(c.last) sysex_open &= ~port_bit(MidiPort::din);
+            else sysex_open |= port_bit(MidiPort::din);
+        }
+        sysex_last_us = micros();
+        record_route(c.from, c.to, c.ts);
+        return true;
+    }
+
+    // the rest of a sysex never came (its last piece didn't fit in the queue, or the sender
+    // went away). end it ourselves so the port isn't held up forever
+    static void cut_sysex() {
+        const uint8_t end = 0xF7;
+        if(sysex_open & port_bit(MidiPort::usb)) usb_sysex(&end, 1, true);
+        if(sysex_open & port_bit(MidiPort::din)) {
+            if(!din.raw(&end, 1)) return; // try again next pass
+            sysex_open &= ~port_bit(MidiPort::din);
+        }
+        // the sources that were mid sysex are the ones routed to the ports we just cut
+        for(uint8_t from = 0; from < MIDI_PORTS; from++) {
+            if(router.destinations(static_cast<MidiPort>(from), 0xF0, 0) != 0) sysex_cut_from |= 1 << from;
+        }
+        _stats.sysex_cut++;
+    }
+
+    // send everything that's queued, returns whether there was anything. a local event waits
+    // (with everything behind it) while a sysex is partway out to any of its ports
+    static bool drain() {
+        Event e;
+        bool any = false;
+        while(out_queue.peek(e) && !(destinations(e) & sysex_open)) {
+            out_queue.pop(e);
+            send(e);
+#ifdef LATENCY_BENCH
+            if(e.type == EventType::note_on) latency_uncommitted++;
+#endif
+            any = true;
+        }
+        while(expr_queue.peek(e) && !(destinations(e) & sysex_open)) {
+            expr_queue.pop(e);
+            send(e);
+            any = true;
+        }
+
+        // sequenced notes are already late by the time we see them, send them right away
+        SequencedEvent s;
+        uint8_t sequenced = 0;
+#ifdef LATENCY_BENCH
+        uint32_t dues[MIDI_SEQ_QUEUE_LEN];
+#endif
+        while(sequenced < MIDI_SEQ_QUEUE_LEN && seq_queue.peek(s) && !(destinations(s.e) & sysex_open)) {
+            seq_queue.pop(s);
+            send(s.e);
+#ifdef LATENCY_BENCH
+            dues[sequenced] = s.due_us;
+#endif
+            sequenced++;
+        }
+        if(sequenced > 0) {
+            flush_usb();
+#ifdef LATENCY_BENCH
+            const uint32_t now = micros();
+            for(uint8_t i = 0; i < sequenced; i++) latency_sequenced(dues[i], now);
+#endif
+            any = true;
+        }
+
+        // other ports after everything local
+        Forward f;
+        uint8_t forwarded = 0;
+        while(forwarded < MIDI_FORWARD_QUEUE_LEN && forward_queue.peek(f)) {
+            // realtime can go in the middle of a sysex
+            if(f.status < 0xF8 && (f.to & sysex_open)) break;
+            forward_queue.pop(f);
+            if(f.to & port_bit(MidiPort::usb)) usb_forward(f);
+            if(f.to & port_bit(MidiPort::din)) din_forward(f);
+            record_route(f.from, f.to, f.ts);
+            forwarded++;
+        }
+        // and sysex last. a new one starts once the keys are out, one piece per pass, but one
+        // that's partway out goes as fast as its ports take it since it's holding everything up
+        BulkChunk c;
+        for(uint8_t pieces = 0; pieces < MIDI_BULK_QUEUE_LEN && bulk_queue.peek(c); pieces++) {
+            if(sysex_open == 0 && (pieces > 0 || out_queue.size() > 0)) break;
+            if(!send_bulk(c)) break;
+            bulk_queue.pop(c);
+            forwarded++;
+        }
+        if(sysex_open != 0 && bulk_queue.size() == 0 && micros() - sysex_last_us > MIDI_SYSEX_STALL_US) {
+            cut_sysex();
+            forwarded++;
+        }
+        // our own replies are short, but still wait for a forwarded one to finish
+        SysExOut reply;
+        while(!(sysex_open & port_bit(MidiPort::usb)) && sysex_out_queue.pop(reply)) {
+            usb_sysex(reply.data, reply.len, true);
+            forwarded++;
         }
+        if(forwarded > 0) {
+            flush_usb();
+            any = true;
+        }
+
+        din.pump();
+        return any;
+    }
+
+    bool add_route(const MidiRoute& route) {
+        Threads::Scope lock(router_mutex);
+        return router.add(route);
+    }
+
+    void clear_routes() {
+        Threads::Scope lock(router_mutex);
+        router.clear();
+    }
+
+    Stats stats() {
+        return _stats;
+    }
+
+    void print_stats(const bool reset) {
+        const auto s = _stats;
+        Serial.printf("midi: %lu notes in %lu usb transactions (%.2f per note)\n", s.notes, s.transactions,
+            s.notes == 0 ? 0.0 : static_cast<double>(s.transactions) / s.notes);
+        Serial.printf("  queue: depth %d (max %d), %lu dropped, %lu note offs suppressed, %lu stalls (max %lu us)\n",
+            out_queue.size(), s.max_depth, s.dropped, s.suppressed_offs, s.stalls, s.max_stall_us);
+        Serial.printf("  mpe: %d members, %lu stolen, %lu expression dropped, %lu sequenced dropped\n",
+            mpe.member_count(), s.stolen, s.expr_dropped, s.seq_dropped);
+        const auto d = din.stats();
+        Serial.printf("  din: %lu messages, %lu bytes, %lu status bytes saved, %lu dropped (%lu note offs), depth %d (max %d of %d)\n",
+            d.messages, d.bytes, d.running_status_saved, d.dropped, d.offs_dropped, din.depth(), d.max_depth, MIDI_DIN_BUFFER_LEN);
+        static const char* port_names[MIDI_PORTS] = { "local", "usb", "din" };
+        Serial.printf("  routes: %lu forwards dropped, %lu din input errors, %lu sysex replies dropped, %lu sysex cut\n",
+            s.forward_dropped, din_in.errors, s.sysex_dropped, s.sysex_cut);
+        for(uint8_t from = 0; from < MIDI_PORTS; from++) {
+            for(uint8_t to = 0; to < MIDI_PORTS; to++) {
+                if(router.routed[from][to] == 0) continue;
+                char name[24];
+                snprintf(name, sizeof(name), "%s -> %s (%lu)", port_names[from], port_names[to], router.routed[from][to]);
+                router.latency[from][to].print(name);
+                if(reset) {
+                    router.latency[from][to] = {};
+                    router.routed[from][to] = 0;
+                }
+            }
+        }
+        if(reset) {
+            _stats = {};
+            din.reset_stats();
+        }
+    }
+
+    // input, called from usbMIDI.read() on the sender thread
+
+    static void emit_in(const InType type, const uint8_t channel, const uint8_t data1, const uint8_t data2) {
+        in_evt.emit({ type, channel, data1, data2, micros() });
+    }
+
+    static void handle_control_change(const uint8_t channel, const uint8_t control, const uint8_t value) {
+        emit_in(InType::control_change, channel, control, value);
+    }
+
+    static void handle_program_change(const uint8_t channel, const uint8_t program) {
+        emit_in(InType::program_change, channel, program, 0);
+    }
+
+    static void handle_sysex(const uint8_t* data, const uint16_t length, const bool complete) {
+        forward_sysex(MidiPort::usb, data, length, complete, micros());
+
+        // usbMIDI hands us its buffer whenever it fills up, split it into chunks we can queue
+        uint16_t offset = 0;
+        do {
+            SysExChunk chunk;
+            chunk.len = std::min<uint16_t>(length - offset, MIDI_SYSEX_CHUNK_LEN);
+            memcpy(chunk.data, data + offset, chunk.len);
+            offset += chunk.len;
+            chunk.last = complete && offset == length;
+            chunk.ts = micros();
+            sysex_evt.emit(chunk);
+        } while(offset < length);
+    }
+
+    // the handlers only see some types, this sees everything but sysex
+    static void route_usb() {
+        const uint8_t type = usbMIDI.getType();
+        if(type == usbMIDI.SystemExclusive) return; // handle_sysex
+        const uint8_t status = type < 0xF0 ? type | (usbMIDI.getChannel() - 1) : type;
+        forward(MidiPort::usb, status, usbMIDI.getData1(), usbMIDI.getData2(), micros());
+    }
+
+    static void handle_din(const uint8_t status, const uint8_t data1, const uint8_t data2) {
+        const uint32_t ts = micros();
+        forward(MidiPort::din, status, data1, data2, ts);
+        const uint8_t channel = (status & 0x0F) + 1;
+        switch(status & 0xF0) {
+            case 0xB0:
+                in_evt.emit({ InType::control_change, channel, data1, data2, ts });
+                return;
+            case 0xC0:
+                in_evt.emit({ InType::program_change, channel, data1, 0, ts });
+                return;
+            default:
+                break;
+        }
+        switch(status) {
+            case 0xF8:
+                in_evt.emit({ InType::clock, 0, 0, 0, ts });
+                break;
+            case 0xFA:
+                in_evt.emit({ InType::start, 0, 0, 0, ts });
+                break;
+            case 0xFB:
+                in_evt.emit({ InType::continue_, 0, 0, 0, ts });
+                break;
+            case 0xFC:
+                in_evt.emit({ InType::stop, 0, 0, 0, ts });
+                break;
+            default:
+                break;
+        }
+    }
+
+    // read everything the host and the din port sent, returns whether there was anything
+    static bool read_all() {
+        bool any = false;
+        while(usbMIDI.read()) {
+            route_usb();
+            any = true;
+        }
+        const uint16_t din_bytes = din_in.poll(handle_din, [](const uint8_t* data, const uint8_t len, const bool last) {
+            forward_sysex(MidiPort::din, data, len, last, micros());
+        });
+        return any || din_bytes > 0;
+    }
+
+    void init() {
+        MIDI_DIN_SERIAL.begin(31250);
+
+        router.add({ MidiPort::local, MidiPort::usb, 0xFFFF, MIDI_TYPE_ALL });
+        router.add({ MidiPort::local, MidiPort::din, 0xFFFF, MIDI_TYPE_ALL });
+        router.add({ MidiPort::usb, MidiPort::din, 0xFFFF, MIDI_TYPE_ALL });
+        router.add({ MidiPort::din, MidiPort::usb, 0xFFFF, MIDI_TYPE_ALL });
+
+        for(auto& s : sounding) {
+            s.note = NOTE_UNMAPPED;
+        }
+
+        usbMIDI.setHandleControlChange(handle_control_change);
+        usbMIDI.setHandleProgramChange(handle_program_change);
+        usbMIDI.setHandleClock([] { emit_in(InType::clock, 0, 0, 0); });
+        usbMIDI.setHandleStart([] { emit_in(InType::start, 0, 0, 0); });
+        usbMIDI.setHandleContinue([] { emit_in(InType::continue_, 0, 0, 0); });
+        usbMIDI.setHandleStop([] { emit_in(InType::stop, 0, 0, 0); });
+        usbMIDI.setHandleSystemExclusive(handle_sysex);
+        event_pump.add(&in_evt);
+        event_pump.add(&sysex_evt);
+
+#ifndef CYCLIC_EXECUTIVE
+        // one thread for both directions. input is parsed every pass instead of every 10 ms,
+        // and the handlers only enqueue so reading never holds up sending
+        threads.addThread([] {
+            while(true) {
+                const bool sent = drain();
+                const bool received = read_all();
+                if(!sent && !received) {
+                    // the producer always ends a batch with a flush event, this just catches stragglers
+                    flush_usb();
+                    Threads::yield();
+                }
+            }
+        });
+#endif
+    }
+
+    void poll() {
+        read_all();
+        drain();
+        flush_usb();
     }
 }
 
@@ -1,7 +1,123 @@
 #pragma once
 #include <cstdint>
+#include "util/deferred_event.hpp"
+#include "midi/mpe.hpp"
+#include "midi/router.hpp"
+
+#define MIDI_QUEUE_LEN 128
+#define MIDI_EXPR_QUEUE_LEN 32
+#define MIDI_SEQ_QUEUE_LEN 32
+#define MIDI_PLAY_MAX_SOUNDING 32 // notes from Midi::play() that can be on at once
+#define MIDI_FORWARD_QUEUE_LEN 64 // messages from one port on their way to another
+#define MIDI_BULK_QUEUE_LEN 8 // sysex pieces on their way to another port
+#define MIDI_SYSEX_OUT_LEN 32
+#define MIDI_SYSEX_OUT_QUEUE_LEN 8
+// a forwarded sysex holds up everything else to its port until it ends, or until this long
+// without a piece of it
+#define MIDI_SYSEX_STALL_US 100'000
+#define MIDI_TX_BATCH_LEN 16 // usb midi packets built up before they're handed to the usb stack
+#define MIDI_SYSEX_CHUNK_LEN 128
+#define MIDI_DIN_SERIAL Serial1 // tx on pin 1
+#define MIDI_DIN_BUFFER_LEN 512
 
 namespace Midi {
+    enum class EventType : uint8_t {
+        note_on, // data1: note, data2: 8 bit velocity
+        note_off, // data1: note
+        control_change, // data1: controller, data2: value
+        pitch_bend, // data1: lsb, data2: msb (7 bits each, 0x2000 is centred)
+        channel_pressure, // data1: pressure
+        mpe_config, // data1: member channels (0 turns mpe off), data2: member pitch bend range in semitones
+        flush // end of a batch, send what's buffered now
+    };
+
+    struct Event {
+        EventType type;
+        uint8_t channel;
+        uint8_t data1;
+        uint8_t data2;
+    };
+
+    enum class InType : uint8_t {
+        control_change, // data1: controller, data2: value
+        program_change, // data1: program
+        clock,
+        start,
+        continue_,
+        stop
+    };
+
+    // incoming midi (usb or din), timestamped as soon as it's parsed
+    struct InMessage {
+        InType type;
+        uint8_t channel;
+        uint8_t data1;
+        uint8_t data2;
+        uint32_t ts;
+    };
+
+    // usb sysex comes in pieces, last is set on the piece that ends the message
+    struct SysExChunk {
+        uint8_t data[MIDI_SYSEX_CHUNK_LEN];
+        uint16_t len;
+        bool last;
+        uint32_t ts;
+    };
+
+    // the usb handlers only copy into these, the listeners run on the event pump
+    inline auto in_evt = DeferredBroadcastEvent<const InMessage, 32>();
+    inline auto sysex_evt = DeferredBroadcastEvent<const SysExChunk, 4>();
+
+    // registers the input events with the event pump, so call this before event_pump.init()
     void init();
+    // drain incoming messages and flush outgoing ones (the cyclic executive calls this instead of running the thread)
+    void poll();
     void velocity_handler(uint8_t row, uint8_t column, uint8_t velocity, bool pressed);
+    // end of a batch: the sender sends everything queued before this in one usb transaction
+    void flush();
+    // queue a note like the keys do, for things that run on the key path's thread (timer service
+    // jobs, or the executive). follow with flush(). note ons are refused while
+    // MIDI_PLAY_MAX_SOUNDING notes are waiting for their note off
+    bool play(const Event& e);
+
+    // switch mpe on (members > 0) or off. any thread, the key path picks it up and sends the zone
+    // setup before its next note
+    void set_mpe(uint8_t members, uint8_t bend_range = MPE_DEFAULT_BEND_RANGE);
+    // the most recent mpe note, 0 if there isn't one: (note on count << 15) | (the pressure its note
+    // on sent << 8) | member channel. the count only tells notes apart
+    uint32_t mpe_last_note();
+    // whether the key path has switched mpe on
+    bool mpe_enabled();
+    // per note pitch bend/pressure/etc that doesn't come from the key path. event pump thread only
+    bool send_expression(const Event& e);
+    // from the arpeggiator/sequencer timer interrupt (only that one producer), due_us is when it
+    // was supposed to play. sent as soon as the sender sees it, no flush needed. a slot is kept for
+    // the note off of the one note the arp can have sounding, so that one never gets dropped
+    bool send_sequenced(const Event& e, uint32_t due_us);
+    // a short, complete sysex message (with the F0 and F7) to usb, for replies to the host. event
+    // pump thread only
+    bool send_sysex(const uint8_t* data, uint8_t len);
+
+    struct Stats {
+        uint32_t notes; // note ons and offs
+        uint32_t transactions; // usb packets we sent (flushes + packets that filled up)
+        uint32_t dropped; // events that didn't fit in the queue (never note offs)
+        uint32_t suppressed_offs; // note offs not sent because their note on was dropped
+        uint32_t stolen; // mpe notes cut off because every member channel was in use
+        uint32_t expr_dropped; // expression events that didn't fit in their queue
+        uint32_t seq_dropped; // same for sequenced events
+        uint32_t forward_dropped; // messages from another port that didn't fit in the forward queues
+        uint32_t sysex_dropped; // send_sysex messages that were too long or didn't fit in the queue
+        uint32_t sysex_cut; // forwarded sysex we ended with our own F7 because the rest never came
+        uint32_t stalls; // usb writes that took longer than STALL_US
+        uint32_t max_stall_us;
+        uint8_t max_depth;
+    };
+    // routes between local, usb and din. by default local goes to both outputs, and usb and din
+    // go to each other. any thread
+    bool add_route(const MidiRoute& route);
+    void clear_routes();
+
+    Stats stats();
+    void print_stats(bool reset);
 }
\ No newline at end of file
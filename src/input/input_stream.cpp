@@ -0,0 +1,63 @@
+#include "input_stream.hpp"
+
+void InputStream::push(const InputType type, const uint8_t source, const int16_t value, const uint32_t ts) {
+    if(!queue.push({ type, source, value, ts })) {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void InputStream::push_note(const uint8_t key, const uint8_t velocity, const bool pressed, const uint32_t ts) {
+    push(pressed ? InputType::note_on : InputType::note_off, key, velocity, ts);
+}
+
+void InputStream::push_encoder(const uint8_t encoder, const int16_t incs, const uint32_t ts) {
+    encoder_ts[encoder].store(ts, std::memory_order_relaxed);
+    encoder_deltas[encoder].fetch_add(incs, std::memory_order_release);
+}
+
+// wraparound safe a < b for micros() timestamps
+static bool before(const uint32_t a, const uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+uint8_t InputStream::deliver() {
+    InputRecord batch[INPUT_BATCH_LEN];
+    uint8_t len = 0;
+    uint8_t delivered = 0;
+
+    const auto flush = [&] {
+        InputBatch b = { batch, len };
+        batch_evt.emit(b);
+        delivered += len;
+        len = 0;
+    };
+    const auto add = [&](const InputRecord& r) {
+        batch[len++] = r;
+        if(len == INPUT_BATCH_LEN) flush();
+    };
+
+    // one record per encoder with everything it moved since the last drain, stamped with its last
+    // move. sorted so they can be merged in with the queue by time
+    InputRecord encoders[INPUT_ENCODERS_LEN];
+    uint8_t encoders_len = 0;
+    for(uint8_t i = 0; i < INPUT_ENCODERS_LEN; i++) {
+        const int16_t delta = encoder_deltas[i].exchange(0, std::memory_order_acquire);
+        if(delta == 0) continue;
+        const InputRecord r = { InputType::encoder, i, delta, encoder_ts[i].load(std::memory_order_relaxed) };
+        uint8_t j = encoders_len++;
+        for(; j > 0 && before(r.ts, encoders[j - 1].ts); j--) encoders[j] = encoders[j - 1];
+        encoders[j] = r;
+    }
+
+    // bounded so producers that keep pushing can't keep the pump here forever
+    uint8_t next_encoder = 0;
+    InputRecord r;
+    for(uint8_t n = 0; n < INPUT_QUEUE_LEN && queue.pop(r); n++) {
+        while(next_encoder < encoders_len && before(encoders[next_encoder].ts, r.ts)) add(encoders[next_encoder++]);
+        add(r);
+    }
+    while(next_encoder < encoders_len) add(encoders[next_encoder++]);
+    if(len > 0) flush();
+
+    return delivered;
+}
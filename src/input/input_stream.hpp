@@ -0,0 +1,64 @@
+// every input (notes from the velocity module, ctrl keys, encoders) as one stream of small
+// timestamped records. producers only push into a lock-free queue, and the event pump drains
+// it and hands listeners the whole burst at once instead of one callback per event. records
+// come in ts order, as far as the producers pushed them in order: a coalesced encoder record is
+// merged in at the time of its last move
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "util/deferred_event.hpp"
+
+#define INPUT_QUEUE_LEN 64
+#define INPUT_BATCH_LEN 16
+#define INPUT_ENCODERS_LEN 5
+#define INPUT_LISTENERS_LEN 8 // everything that turns input into midi listens here
+
+enum class InputType : uint8_t {
+    note_on, // source: key index (row * COLS_LEN + column), value: velocity
+    note_off, // source: key index
+    ctrl_key, // source: CtrlKey
+    encoder // source: encoder index, value: increments since the last record (coalesced)
+};
+
+struct InputRecord {
+    InputType type;
+    uint8_t source;
+    int16_t value;
+    uint32_t ts; // micros() when it happened
+};
+
+struct InputBatch {
+    const InputRecord* records;
+    uint8_t len;
+};
+
+class InputStream : public DeferredEventBase {
+private:
+    MpscQueue<InputRecord, INPUT_QUEUE_LEN> queue;
+
+    // encoders don't go through the queue, their deltas add up here until the next drain
+    std::atomic<int16_t> encoder_deltas[INPUT_ENCODERS_LEN] = {};
+    std::atomic<uint32_t> encoder_ts[INPUT_ENCODERS_LEN] = {};
+
+    BroadcastEvent<const InputBatch, INPUT_LISTENERS_LEN> batch_evt;
+
+protected:
+    uint8_t deliver() override;
+
+public:
+    void push(InputType type, uint8_t source, int16_t value, uint32_t ts);
+    void push_note(uint8_t key, uint8_t velocity, bool pressed, uint32_t ts);
+    void push_encoder(uint8_t encoder, int16_t incs, uint32_t ts);
+
+    // called on the event pump with everything that came in since the last drain
+    auto add_listener(BroadcastEvent<const InputBatch, INPUT_LISTENERS_LEN>::Listener listener) {
+        return batch_evt.add_listener(std::move(listener));
+    }
+    void remove_listener(const BroadcastEvent<const InputBatch, INPUT_LISTENERS_LEN>::ListenerId id) {
+        batch_evt.remove_listener(id);
+    }
+};
+
+inline InputStream input_stream;
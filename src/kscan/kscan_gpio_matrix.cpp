@@ -8,21 +8,30 @@
 #include "kscan_gpio_matrix.hpp"
 #include "debounce.hpp"
 #include <Arduino.h>
-#include "scheduler/scheduler_thread.hpp"
+#include "scheduler/scheduler.hpp"
+#include "util/latency.hpp"
 
 //#define KSCAN_MATRIX_DEBUG
 
+// scans are run ahead of velocity timeouts, a late scan delays every key
+#define KSCAN_SCHEDULER_PRIORITY 2
+
 /** Current state of the matrix as a flattened 2D array of length
  * (config->rows * config->cols) */
 static debounce_state matrix_state[MATRIX_LEN];
 
 kscan_callback_t kscan_callback;
+kscan_batch_callback_t kscan_batch_callback;
 /** Timestamp of the current or scheduled scan, in microseconds. */
 uint32_t kscan_scan_time;
 
 static void kscan_matrix_irq_callback_handler();
 void kscan_matrix_read(uint8_t poll_counter);
 
+Scheduler<uint8_t> matrix_scheduler = Scheduler<uint8_t>("kscan", KSCAN_SCHEDULER_PRIORITY, [](uint8_t& i) {
+    kscan_matrix_read(i);
+});
+
 static void kscan_matrix_interrupt_enable() {
 #ifdef KSCAN_MATRIX_DEBUG
     Serial.println("kscan_matrix_interrupt_enable");
@@ -56,7 +65,13 @@ static void kscan_matrix_irq_callback_handler() {
 
     kscan_scan_time = micros(); // https://www.utopiamechanicus.com/article/handling-arduino-microsecond-overflow/
 
-    kscan_matrix_read(5); // start polling for a bit to try to catch everything
+    // start polling for a bit to try to catch everything. the scan itself runs on the timer
+    // service thread instead of in here so we're not doing 9 columns of delays inside the interrupt
+    if(!matrix_scheduler.schedule_at_from_isr(kscan_scan_time, kscan_scan_time, 5)) {
+        // can't happen while the interrupts are detached until the scan finishes,
+        // but don't leave the matrix deaf if it somehow does
+        kscan_matrix_interrupt_enable();
+    }
 }
 
 static int state_index(const uint8_t input_idx, const uint8_t output_idx) {
@@ -67,10 +82,6 @@ static int state_index_rc(const uint8_t row, const uint8_t col) {
     return state_index(row, col);
 }
 
-SchedulerThread<uint8_t> matrix_scheduler = SchedulerThread<uint8_t>([](uint8_t& i) {
-    kscan_matrix_read(i);
-});
-
 void kscan_matrix_read(uint8_t poll_counter) {
 #ifdef KSCAN_MATRIX_DEBUG
     Serial.println("_kscan_matrix_read");
@@ -93,6 +104,12 @@ void kscan_matrix_read(uint8_t poll_counter) {
             }
 #endif
 
+#ifdef LATENCY_BENCH
+            if(!debounce_is_pressed(&matrix_state[index])) {
+                latency_raw(index, active, kscan_scan_time);
+            }
+#endif
+
             debounce_update(&matrix_state[index], active, KSCAN_DEBOUNCE_SCAN_PERIOD_MS);
         }
 
@@ -104,6 +121,7 @@ void kscan_matrix_read(uint8_t poll_counter) {
 #endif
 
     // Process the new state.
+    bool any_changed = false;
     bool continue_scan = poll_counter > 0; // sometimes an interrupt will be triggered but the switch will jitter a bit and seem like it wasn't pressed
     // but we know it was pressed, so continue even if the debouncer says nothing is active
 
@@ -116,14 +134,22 @@ void kscan_matrix_read(uint8_t poll_counter) {
                 const bool pressed = debounce_is_pressed(state);
 #ifdef KSCAN_MATRIX_DEBUG
                 Serial.printf("r: %d, c: %d, pressed: %d\n", r, c, pressed);
+#endif
+#ifdef LATENCY_BENCH
+                latency_kscan(index, pressed, micros());
 #endif
                 kscan_callback(r, c, pressed);
+                any_changed = true;
             }
 
             continue_scan = continue_scan || debounce_is_active(state);
         }
     }
 
+    if(any_changed) {
+        kscan_batch_callback();
+    }
+
 #ifdef KSCAN_MATRIX_DEBUG
     Serial.println("_kscan_matrix_read process done");
 #endif
@@ -146,8 +172,13 @@ void kscan_matrix_read(uint8_t poll_counter) {
     }
 }
 
-void kscan_matrix_configure(kscan_callback_t callback) {
+void kscan_matrix_poll() {
+    matrix_scheduler.run_all_due();
+}
+
+void kscan_matrix_configure(kscan_callback_t callback, kscan_batch_callback_t batch_callback) {
     kscan_callback = callback;
+    kscan_batch_callback = batch_callback;
 }
 
 void kscan_matrix_enable() {
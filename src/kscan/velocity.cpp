@@ -1,8 +1,10 @@
 #include "velocity.hpp"
 #include "kscan_gpio_matrix.hpp"
-#include "scheduler/scheduler_thread.hpp"
+#include "scheduler/scheduler.hpp"
 #include "hardware/ctrl_keys.hpp"
 #include "util/log.hpp"
+#include "input/input_stream.hpp"
+#include "util/latency.hpp"
 
 /*
 
@@ -41,9 +43,15 @@ on key press
 auto l = new Log<false>("velocity");
 
 velocity_callback_t velocity_callback;
+velocity_batch_callback_t velocity_batch_callback;
 
-void velocity_configure(velocity_callback_t callback) {
+void velocity_configure(velocity_callback_t callback, velocity_batch_callback_t batch_callback) {
     velocity_callback = callback;
+    velocity_batch_callback = batch_callback;
+}
+
+void velocity_kscan_batch_handler() {
+    velocity_batch_callback();
 }
 
 enum class KeyType : uint8_t {
@@ -68,14 +76,19 @@ static void get_key_pos(const uint8_t row, const uint8_t column, uint8_t* out_r,
 // TODO: tune these values
 #define VELOCITY_TIMEOUT 100'000 // 100ms
 #define VELOCITY_TIMEOUT_VALUE 150
+#define VELOCITY_SCHEDULER_PRIORITY 1
 
 void scheduler_work(const uint8_t& index);
-auto scheduler = SchedulerThread(scheduler_work);
+auto scheduler = Scheduler("velocity", VELOCITY_SCHEDULER_PRIORITY, scheduler_work);
 
 void velocity_init() {
     scheduler.init();
 }
 
+void velocity_poll() {
+    scheduler.run_all_due();
+}
+
 
 enum class TimerState : uint8_t {
     none,
@@ -85,43 +98,51 @@ enum class TimerState : uint8_t {
 
 struct KeyState {
     TimerState timer_state = TimerState::none;
+    JobHandle timeout_job; // valid while timer_state is running
     uint32_t top_ts = 0;
     uint8_t velocity = 0;
     bool playing = false;
 };
 
+// only touched with key_states_lock held, so it doesn't need to be volatile
 Threads::Mutex key_states_lock;
-volatile static KeyState key_states[MATRIX_LEN / 2];
+static KeyState key_states[MATRIX_LEN / 2];
 
-void send_press(const uint8_t r, const uint8_t c, volatile KeyState* state) {
+uint8_t get_index(const uint8_t row, const uint8_t column) {
+    return row * COLS_LEN + column;
+}
+
+void send_press(const uint8_t r, const uint8_t c, KeyState* state) {
     if(!state->playing) {
         state->playing = true;
         velocity_callback(r, c, state->velocity, true);
+        input_stream.push_note(get_index(r, c), state->velocity, true, micros());
     }
 }
 
-void send_release(const uint8_t r, const uint8_t c, volatile KeyState* state) {
+void send_release(const uint8_t r, const uint8_t c, KeyState* state) {
     if(state->playing) {
         state->playing = false;
         velocity_callback(r, c, 0, false);
+        input_stream.push_note(get_index(r, c), 0, false, micros());
     }
 }
 
-uint8_t get_index(const uint8_t row, const uint8_t column) {
-    return row * COLS_LEN + column;
-}
-
 void scheduler_work(const uint8_t& index) {
-    Threads::Scope m(key_states_lock);
+    {
+        Threads::Scope m(key_states_lock);
 
-    const auto state = &key_states[index];
-    if(state->timer_state != TimerState::running) {
-        return; // shouldn't be in this state
-    }
-    state->timer_state = TimerState::timed_out;
-    state->velocity = VELOCITY_TIMEOUT_VALUE;
+        const auto state = &key_states[index];
+        if(state->timer_state != TimerState::running) {
+            return; // shouldn't be in this state
+        }
+        state->timer_state = TimerState::timed_out;
+        state->timeout_job = {};
+        state->velocity = VELOCITY_TIMEOUT_VALUE;
 
-    send_press(index / COLS_LEN, index % COLS_LEN, state);
+        send_press(index / COLS_LEN, index % COLS_LEN, state);
+    }
+    velocity_batch_callback();
 }
 void velocity_kscan_handler(const uint8_t matrix_row, const uint8_t matrix_column, const bool pressed) {
     Threads::Scope m(key_states_lock);
@@ -129,9 +150,10 @@ void velocity_kscan_handler(const uint8_t matrix_row, const uint8_t matrix_colum
     l->debug("kscan handler: %d, %d, %d\n", matrix_row, matrix_column, pressed);
 
     const auto type = key_type(matrix_row, matrix_column);
-    if(type == KeyType::ctrl && pressed) {
+    if(type == KeyType::ctrl) {
         const auto key = static_cast<CtrlKey>(matrix_column);
-        ctrl_keys_evt.emit(key);
+        input_stream.push(InputType::ctrl_key, key, pressed, micros());
+        if(pressed) ctrl_keys_evt.emit(key);
         return;
     }
 
@@ -148,7 +170,8 @@ void velocity_kscan_handler(const uint8_t matrix_row, const uint8_t matrix_colum
             }
             if(state->timer_state == TimerState::running) {
                 // cancel job
-                scheduler.cancel(index);
+                scheduler.cancel(state->timeout_job);
+                state->timeout_job = {};
                 state->timer_state = TimerState::none;
             }
             if(state->velocity != 0) {
@@ -165,6 +188,9 @@ void velocity_kscan_handler(const uint8_t matrix_row, const uint8_t matrix_colum
                 l->debug("unexpected state (bottom pressed before top?), setting to default velocity and sending\n");
                 // send it
             }
+#ifdef LATENCY_BENCH
+            if(!state->playing) latency_decision(index, micros());
+#endif
             send_press(row, column, state);
         } else {
             send_release(row, column, state);
@@ -176,7 +202,7 @@ void velocity_kscan_handler(const uint8_t matrix_row, const uint8_t matrix_colum
                 l->debug("setting top_ts and starting timeout\n");
                 // if velocity is set, the bottom switch would have been pressed before, so already key pressed
                 state->top_ts = micros();
-                scheduler.schedule(VELOCITY_TIMEOUT, index);
+                state->timeout_job = scheduler.schedule(VELOCITY_TIMEOUT, index);
                 state->timer_state = TimerState::running;
             } else {
                 l->debug("top pressed but velocity is already set, ignoring\n");
@@ -188,7 +214,8 @@ void velocity_kscan_handler(const uint8_t matrix_row, const uint8_t matrix_colum
 
             // temp fix for keys getting stuck on
             if(state->timer_state == TimerState::running) {
-                scheduler.cancel(index);
+                scheduler.cancel(state->timeout_job);
+                state->timeout_job = {};
                 state->timer_state = TimerState::none;
             }
         }
@@ -2,7 +2,12 @@
 #include <cstdint>
 
 typedef void(* velocity_callback_t) (uint8_t row, uint8_t column, uint8_t velocity, bool pressed);
+// called after a scan or a velocity timeout that may have produced velocity callbacks
+typedef void(* velocity_batch_callback_t) ();
 
 void velocity_kscan_handler(uint8_t matrix_row, uint8_t matrix_column, bool pressed);
+void velocity_kscan_batch_handler();
 void velocity_init();
-void velocity_configure(velocity_callback_t callback);
\ No newline at end of file
+void velocity_configure(velocity_callback_t callback, velocity_batch_callback_t batch_callback);
+// run due velocity timeouts on the calling thread (for the cyclic executive)
+void velocity_poll();
\ No newline at end of file
@@ -1,5 +1,6 @@
 //#define I2C_SCAN
 //#define MATRIX_TEST
+//#define DSP_SELFTEST
 
 #include <Arduino.h>
 #include <TeensyThreads.h>
@@ -16,6 +17,9 @@ ThreadWrap(Serial, SerialWrapped)
 #include "hardware/oled.hpp"
 #include "hardware/ctrl_keys.hpp"
 #include "hardware/midi.hpp"
+#include "scheduler/timer_service.hpp"
+#include "scheduler/executive.hpp"
+#include "hardware/mem_info.hpp"
 
 #ifdef I2C_SCAN
 #include "test/i2c_scan.hpp"
@@ -24,11 +28,43 @@ ThreadWrap(Serial, SerialWrapped)
 #ifdef MATRIX_TEST
 #include "test/matrix_test.hpp"
 #endif
+
+#ifdef DSP_SELFTEST
+#include "dsp/dsp_selftest.hpp"
+#endif
 #include "hardware/files.hpp"
+#include "input/input_stream.hpp"
+#include "midi/mpe.hpp"
+#include "midi/midi_clock.hpp"
+#include "midi/arp.hpp"
+#include "midi/recorder.hpp"
+#include "midi/encoder_midi.hpp"
+#include "midi/preset_transfer.hpp"
+#include "synth/synth.hpp"
+#include "util/latency.hpp"
 
 // rust ffi
 extern "C" int foo();
 
+// everything that keeps stats, on the menu key
+static void print_stats() {
+    print_mem_info();
+    timer_service.print_stats(false);
+    Midi::print_stats(false);
+#ifdef CYCLIC_EXECUTIVE
+    executive_print_report(false);
+#endif
+    arp_print_stats(false);
+    midi_clock_print_stats(false);
+    encoder_midi.print_stats(false);
+    preset_transfer.print_stats(false);
+    recorder_print_stats();
+    synth_print_stats(false);
+#ifdef LATENCY_BENCH
+    latency_print_report(false);
+#endif
+}
+
 void setup() {
     for(int i = 0; i < 3; i++) {
         Serial.println("Yeag!");
@@ -48,6 +84,15 @@ void setup() {
 #ifdef MATRIX_TEST
     matrix_test();
 #endif
+#ifdef DSP_SELFTEST
+    {
+        // the asm in dsp/intrinsics.hpp against dsp_ref, takes a second or so
+        const uint32_t seed = micros();
+        const auto r = dsp_selftest(seed, 20000);
+        if(r.failures == 0) Serial.printf("dsp selftest: %lu checks passed\n", r.checks);
+        else Serial.printf("ERR: dsp selftest: seed %lu, %lu/%lu failed, first %s\n", seed, r.failures, r.checks, r.first_failure);
+    }
+#endif
 
     MPWire.begin();
     i2c_mp_init();
@@ -62,17 +107,42 @@ void setup() {
 
     ctrl_keys_evt.add_listener([](const CtrlKey& evt) {
         Serial.printf("ctrl_keys_evt: %d\n", evt);
+        if(evt == KEY_MENU) print_stats();
         return false;
     });
+    input_stream.add_listener([](const InputBatch& batch) {
+        for(uint8_t i = 0; i < batch.len; i++) {
+            const auto& r = batch.records[i];
+            if(r.type == InputType::encoder) {
+                Serial.printf("enc %d: %d\n", r.source, r.value);
+            }
+        }
+    });
+    mpe_expression_init();
+    encoder_midi.init();
+    event_pump.add(&input_stream);
+    event_pump.add(&ctrl_keys_evt);
+    event_pump.add(&enc_ctrl_evt);
 
     kscan_matrix_init();
-    kscan_matrix_configure(velocity_kscan_handler);
+    kscan_matrix_configure(velocity_kscan_handler, velocity_kscan_batch_handler);
     // velocity_configure([](const uint8_t r, const uint8_t c, const uint8_t velocity, const bool pressed) {
     //     Serial.printf("r: %d, c: %d, velocity: %d, pressed: %d\n", r, c, velocity, pressed);
     // });
-    velocity_configure(Midi::velocity_handler);
+    velocity_configure(Midi::velocity_handler, Midi::flush);
     velocity_init();
+    recorder_init();
+    synth_init();
+#ifdef CYCLIC_EXECUTIVE
+    executive_init(); // runs kscan, velocity, midi and the encoders in fixed slots
+#else
+    timer_service.init(); // runs the jobs for kscan and velocity
+#endif
     Midi::init();
+    midi_clock_init();
+    preset_transfer.init();
+    arp_init();
+    event_pump.init(); // after everything has added its deferred events
     kscan_matrix_enable();
 
     // ui_init();
@@ -0,0 +1,264 @@
+#include "arp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <Arduino.h>
+#include <TeensyThreads.h>
+#include <TeensyTimerTool.h>
+#include "hardware/midi.hpp"
+#include "input/input_stream.hpp"
+#include "midi/note_map.hpp"
+#include "midi/midi_clock.hpp"
+
+// gpt is 32 bits, so a whole step fits in one trigger at any tempo
+static TeensyTimerTool::OneShotTimer timer(TeensyTimerTool::GPT2);
+
+struct ArpStep {
+    uint8_t note; // NOTE_UNMAPPED for a rest
+    uint8_t channel;
+    uint8_t velocity;
+    uint8_t gate; // percent
+};
+
+struct ArpPattern {
+    ArpStep steps[ARP_MAX_STEPS];
+    uint8_t len;
+    uint32_t step_us;
+    uint8_t steps_per_beat;
+    bool sync;
+};
+
+// the pump builds the one that isn't current, then swaps. the timer interrupt copies what it
+// needs out of the current one every step and can't be preempted by the pump, so a swap never
+// lands in the middle of a read
+static ArpPattern patterns[2];
+static std::atomic<const ArpPattern*> current{&patterns[0]};
+
+// builder state, guarded by builder_lock
+struct HeldNote {
+    uint8_t key;
+    uint8_t note;
+    uint8_t channel;
+    uint8_t velocity;
+};
+static Threads::Mutex builder_lock;
+static HeldNote held[ARP_MAX_HELD]; // in the order they were pressed
+static uint8_t held_len = 0;
+static ArpConfig config;
+static SeqStep sequence[SEQ_MAX_STEPS];
+static uint8_t sequence_len = 0;
+
+static std::atomic<bool> playing_keys{false};
+
+// interrupt state
+static std::atomic<bool> running{false};
+static uint8_t step_index = 0;
+static uint32_t step_due = 0; // when the next step starts
+static uint32_t off_due = 0; // when the sounding note ends
+static ArpStep sounding = { NOTE_UNMAPPED, 0, 0, 0 };
+static ArpStats _stats = {};
+
+static bool before(const uint32_t a, const uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+// fires at due, or as soon as it can if that's already gone (a short gate on a late step).
+// signed, so a due in the past doesn't wrap to an hour from now
+static void trigger_at(const uint32_t due) {
+    const int32_t d = due - micros();
+    timer.trigger(d > 1 ? d : 1);
+}
+
+static uint32_t step_length(const ArpPattern* p) {
+    if(p->sync) {
+        const auto clock = midi_clock_now();
+        if(clock.locked) return static_cast<uint32_t>(clock.period_us * CLOCK_PPQN / p->steps_per_beat);
+    }
+    return p->step_us;
+}
+
+static bool emit(const Midi::EventType type, const ArpStep& step, const uint32_t due) {
+    return Midi::send_sequenced({ type, step.channel, step.note, type == Midi::EventType::note_on ? step.velocity : static_cast<uint8_t>(0) }, due);
+}
+
+static void timer_isr() {
+    const uint32_t now = micros();
+    const uint32_t due = sounding.note != NOTE_UNMAPPED && before(off_due, step_due) ? off_due : step_due;
+    if(before(now, due)) {
+        // woke up early (the timer rounds), go back to sleep for the rest
+        trigger_at(due);
+        return;
+    }
+
+    const uint32_t late = now - due;
+    const uint8_t bucket = late == 0 ? 0 : 32 - __builtin_clz(late);
+    _stats.late_us[std::min<uint8_t>(bucket, 15)]++;
+    if(late > _stats.max_late_us) _stats.max_late_us = late;
+
+    if(sounding.note != NOTE_UNMAPPED && !before(now, off_due)) {
+        emit(Midi::EventType::note_off, sounding, off_due);
+        sounding.note = NOTE_UNMAPPED;
+    }
+
+    if(!before(now, step_due)) {
+        const auto p = current.load(std::memory_order_acquire);
+        if(p->len == 0) {
+            // nothing held or the arp is off. a sounding note was just turned off above, since
+            // the gate is always shorter than the step
+            running.store(false);
+            return;
+        }
+        if(step_index >= p->len) step_index = 0;
+        const auto step = p->steps[step_index++];
+        const uint32_t length = step_length(p);
+        // a dropped note on doesn't owe a note off
+        if(step.note != NOTE_UNMAPPED && emit(Midi::EventType::note_on, step, step_due)) {
+            sounding = step;
+            off_due = step_due + std::max<uint32_t>(length * step.gate / 100, 1);
+        }
+        _stats.steps++;
+        step_due += length;
+        // fell more than a step behind (tempo went way up, or interrupts were off), don't try to catch up
+        if(before(step_due, now)) step_due = now + length;
+    }
+
+    const uint32_t next = sounding.note != NOTE_UNMAPPED && before(off_due, step_due) ? off_due : step_due;
+    trigger_at(next);
+}
+
+// builder, with builder_lock held
+
+static void add_octaves(ArpPattern& p, const HeldNote* notes, const uint8_t len, const bool reverse) {
+    for(uint8_t o = 0; o < config.octaves; o++) {
+        for(uint8_t i = 0; i < len && p.len < ARP_MAX_STEPS; i++) {
+            const uint8_t oct = reverse ? config.octaves - 1 - o : o;
+            const auto& n = notes[reverse ? len - 1 - i : i];
+            const int16_t note = n.note + 12 * oct;
+            if(note > 127) continue;
+            p.steps[p.len++] = { static_cast<uint8_t>(note), n.channel, n.velocity, config.gate };
+        }
+    }
+}
+
+static void build(ArpPattern& p) {
+    p.len = 0;
+    p.steps_per_beat = std::max<uint8_t>(config.steps_per_beat, 1);
+    p.step_us = 60'000'000ul / (std::max<uint16_t>(config.bpm, 1) * p.steps_per_beat);
+    p.sync = config.sync;
+    if(config.mode == ArpMode::off || held_len == 0) return;
+
+    HeldNote sorted[ARP_MAX_HELD];
+    std::copy(held, held + held_len, sorted);
+    std::sort(sorted, sorted + held_len, [](const HeldNote& a, const HeldNote& b) { return a.note < b.note; });
+
+    switch(config.mode) {
+        case ArpMode::up:
+            add_octaves(p, sorted, held_len, false);
+            break;
+        case ArpMode::down:
+            add_octaves(p, sorted, held_len, true);
+            break;
+        case ArpMode::up_down: {
+            add_octaves(p, sorted, held_len, false);
+            // back down, leaving out the top and bottom so they don't play twice in a row
+            const uint8_t up_len = p.len;
+            for(int16_t i = up_len - 2; i > 0 && p.len < ARP_MAX_STEPS; i--) {
+                p.steps[p.len++] = p.steps[i];
+            }
+            break;
+        }
+        case ArpMode::as_played:
+            add_octaves(p, held, held_len, false);
+            break;
+        case ArpMode::sequencer:
+            for(uint8_t i = 0; i < sequence_len; i++) {
+                const auto& s = sequence[i];
+                const int16_t note = sorted[0].note + s.offset;
+                const bool rest = !s.active || note < 0 || note > 127;
+                p.steps[p.len++] = {
+                    rest ? static_cast<uint8_t>(NOTE_UNMAPPED) : static_cast<uint8_t>(note), sorted[0].channel,
+                    s.velocity == 0 ? sorted[0].velocity : s.velocity, s.gate == 0 ? config.gate : s.gate
+                };
+            }
+            break;
+        default:
+            break;
+    }
+
+    // a full gate would have the note off land on the next note on
+    for(uint8_t i = 0; i < p.len; i++) {
+        p.steps[i].gate = std::clamp<uint8_t>(p.steps[i].gate, 1, 99);
+    }
+}
+
+static void rebuild() {
+    const auto next = current.load(std::memory_order_relaxed) == &patterns[0] ? &patterns[1] : &patterns[0];
+    build(*next);
+    current.store(next, std::memory_order_release);
+
+    // publishing first means an interrupt that's about to stop sees the new pattern, and if
+    // it already stopped we see running == false
+    if(next->len > 0 && !running.load()) {
+        running.store(true);
+        step_index = 0;
+        step_due = micros() + 100; // enough time to be back out of here before it fires
+        sounding.note = NOTE_UNMAPPED;
+        timer.trigger(100);
+    }
+}
+
+static void handle_note(const InputRecord& r) {
+    if(r.type == InputType::note_on) {
+        const auto m = note_map_lookup(r.source);
+        if(m.note == NOTE_UNMAPPED || held_len == ARP_MAX_HELD) return;
+        held[held_len++] = { r.source, m.note, m.channel, static_cast<uint8_t>(r.value) };
+    } else {
+        const auto it = std::find_if(held, held + held_len, [&](const HeldNote& n) { return n.key == r.source; });
+        if(it == held + held_len) return;
+        std::copy(it + 1, held + held_len, it);
+        held_len--;
+    }
+}
+
+void arp_init() {
+    timer.begin(timer_isr);
+    input_stream.add_listener([](const InputBatch& batch) {
+        Threads::Scope m(builder_lock);
+        bool changed = false;
+        for(uint8_t i = 0; i < batch.len; i++) {
+            const auto& r = batch.records[i];
+            if(r.type != InputType::note_on && r.type != InputType::note_off) continue;
+            handle_note(r);
+            changed = true;
+        }
+        if(changed) rebuild();
+    });
+}
+
+void arp_configure(const ArpConfig& c) {
+    Threads::Scope m(builder_lock);
+    config = c;
+    playing_keys.store(c.mode != ArpMode::off, std::memory_order_relaxed);
+    rebuild();
+}
+
+void arp_set_sequence(const SeqStep* steps, const uint8_t len) {
+    Threads::Scope m(builder_lock);
+    sequence_len = std::min<uint8_t>(len, SEQ_MAX_STEPS);
+    std::copy(steps, steps + sequence_len, sequence);
+    rebuild();
+}
+
+bool arp_playing_keys() {
+    return playing_keys.load(std::memory_order_relaxed);
+}
+
+void arp_print_stats(const bool reset) {
+    const auto s = _stats;
+    Serial.printf("arp: %lu steps, %s, max %lu us late\n  late (us):", s.steps, running.load() ? "running" : "stopped", s.max_late_us);
+    for(uint8_t i = 0; i < 16; i++) {
+        if(s.late_us[i] == 0) continue;
+        Serial.printf(" <%lu:%lu", 1ul << i, s.late_us[i]);
+    }
+    Serial.printf("\n");
+    if(reset) _stats = {};
+}
@@ -0,0 +1,52 @@
+// arpeggiator and step sequencer for the held keys. the event pump turns the held notes and the
+// settings into a pattern ahead of time, and a hardware timer interrupt walks it, so steps land
+// on time instead of whenever a thread gets scheduled. notes go to the midi sender through
+// Midi::send_sequenced()
+
+#pragma once
+
+#include <cstdint>
+
+#define ARP_MAX_HELD 16
+#define ARP_MAX_STEPS 64
+#define SEQ_MAX_STEPS 16
+
+enum class ArpMode : uint8_t {
+    off,
+    up,
+    down,
+    up_down, // without repeating the top and bottom notes
+    as_played,
+    sequencer // the steps from arp_set_sequence(), transposed to the lowest held note
+};
+
+struct ArpConfig {
+    ArpMode mode = ArpMode::off;
+    uint16_t bpm = 120;
+    uint8_t steps_per_beat = 4;
+    uint8_t gate = 50; // percent of a step
+    uint8_t octaves = 1; // the arp repeats the held notes this many octaves up
+    bool sync = false; // follow the midi clock's tempo while it's locked
+};
+
+struct SeqStep {
+    bool active; // a rest if not
+    int8_t offset; // semitones from the lowest held note
+    uint8_t velocity; // 8 bit, 0 to use the held key's
+    uint8_t gate; // percent of a step, 0 to use ArpConfig::gate
+};
+
+struct ArpStats {
+    uint32_t steps;
+    uint32_t max_late_us; // timer interrupt vs when the step was due
+    uint32_t late_us[16]; // log2 buckets like LatencyHistogram
+};
+
+// adds the input_stream listener, so call before event_pump.init()
+void arp_init();
+// any thread
+void arp_configure(const ArpConfig& config);
+void arp_set_sequence(const SeqStep* steps, uint8_t len);
+// whether held keys go to the arp instead of straight out
+bool arp_playing_keys();
+void arp_print_stats(bool reset);
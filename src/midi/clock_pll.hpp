@@ -0,0 +1,150 @@
+// software pll for incoming midi clock. usb delivers ticks in frames, so the raw timestamps
+// jitter by up to a frame. an alpha-beta filter tracks the tick period and phase, and
+// everything tempo related reads the filtered clock instead of the raw ticks.
+// only uses the timestamps it's given, so it runs the same on the host
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+
+#define CLOCK_PPQN 24
+// intervals outside this range (300 to 20 bpm) aren't a clock we can follow
+#define CLOCK_MIN_PERIOD_US (60'000'000 / (300 * CLOCK_PPQN))
+#define CLOCK_MAX_PERIOD_US (60'000'000 / (20 * CLOCK_PPQN))
+
+// what other modules see
+struct BeatClock {
+    bool running; // between start/continue and stop
+    bool locked;
+    uint32_t tick; // ticks since start
+    uint32_t tick_us; // filtered time of that tick
+    float period_us; // per tick, 0 until there's an estimate
+
+    // position in ticks at now, never more than a tick past the last one we got
+    [[nodiscard]] float ticks_at(const uint32_t now) const {
+        if(period_us == 0) return tick;
+        const float since = static_cast<int32_t>(now - tick_us) / period_us;
+        return tick + std::fmin(std::fmax(since, 0.0f), 1.0f);
+    }
+
+    [[nodiscard]] float beats_at(const uint32_t now) const {
+        return ticks_at(now) / CLOCK_PPQN;
+    }
+
+    [[nodiscard]] float bpm() const {
+        return period_us == 0 ? 0 : 60'000'000.0f / (period_us * CLOCK_PPQN);
+    }
+};
+
+struct ClockStats {
+    uint32_t ticks;
+    uint32_t resyncs; // ticks too far from the prediction to correct, the estimate started over
+    uint32_t locks;
+    uint32_t unlocks;
+    float jitter_us; // smoothed |phase error|
+    uint32_t max_jitter_us;
+};
+
+class ClockPll {
+private:
+    // phase and period gains, beta = alpha^2 / 4 is critically damped
+    const float alpha;
+    const float beta;
+
+    bool has_last = false;
+    uint32_t last_raw = 0;
+    uint32_t predicted = 0; // when the next tick should arrive
+    uint8_t good_ticks = 0;
+    uint8_t filtered = 0; // ticks since the estimate started over
+    uint32_t next_tick = 0;
+    BeatClock clock = {};
+    ClockStats _stats = {};
+
+    static constexpr uint8_t LOCK_TICKS = CLOCK_PPQN; // a beat of steady ticks before we call it locked
+    static constexpr float LOCK_JITTER = 0.05f; // of a period
+    static constexpr float UNLOCK_JITTER = 0.15f;
+
+    void restart(const uint32_t ts, const uint32_t interval) {
+        const bool plausible = interval >= CLOCK_MIN_PERIOD_US && interval <= CLOCK_MAX_PERIOD_US;
+        clock.period_us = plausible ? interval : 0;
+        predicted = ts + interval;
+        good_ticks = 0;
+        filtered = 2; // the interval is two ticks' worth
+        _stats.jitter_us = 0;
+        if(clock.locked) _stats.unlocks++;
+        clock.locked = false;
+    }
+
+public:
+    explicit ClockPll(const float alpha = 0.125f) : alpha(alpha), beta(alpha * alpha / 4) {}
+
+    void tick(const uint32_t ts) {
+        _stats.ticks++;
+        clock.tick = next_tick++;
+        clock.tick_us = ts;
+
+        if(!has_last) {
+            has_last = true;
+        } else if(clock.period_us == 0) {
+            restart(ts, ts - last_raw);
+        } else {
+            const float error = static_cast<int32_t>(ts - predicted);
+            if(std::fabs(error) > clock.period_us / 2) {
+                // missed ticks or a tempo jump, don't try to slew that far
+                _stats.resyncs++;
+                restart(ts, ts - last_raw);
+            } else {
+                // the first period is a single interval, off by up to a usb frame. until there are
+                // enough ticks for alpha and beta, use the gains of a least squares line fit through
+                // all of them, so that error is gone in a few ticks instead of ringing for a hundred
+                if(filtered < UINT8_MAX) filtered++;
+                const float n = filtered;
+                const float a = std::fmax(alpha, 2 * (2 * n - 1) / (n * (n + 1)));
+                const float b = std::fmax(beta, 6 / (n * (n + 1)));
+                clock.tick_us = predicted + static_cast<int32_t>(a * error);
+                clock.period_us = std::fmin(std::fmax(clock.period_us + b * error,
+                    static_cast<float>(CLOCK_MIN_PERIOD_US)), static_cast<float>(CLOCK_MAX_PERIOD_US));
+                predicted = clock.tick_us + static_cast<uint32_t>(clock.period_us);
+
+                const float abs_error = std::fabs(error);
+                _stats.jitter_us += (abs_error - _stats.jitter_us) / 16;
+                if(abs_error > _stats.max_jitter_us) _stats.max_jitter_us = abs_error;
+
+                if(_stats.jitter_us < clock.period_us * LOCK_JITTER) {
+                    if(!clock.locked && ++good_ticks >= LOCK_TICKS) {
+                        clock.locked = true;
+                        _stats.locks++;
+                    }
+                } else {
+                    good_ticks = 0;
+                    if(clock.locked && _stats.jitter_us > clock.period_us * UNLOCK_JITTER) {
+                        clock.locked = false;
+                        _stats.unlocks++;
+                    }
+                }
+            }
+        }
+        last_raw = ts;
+    }
+
+    // the tick after a start is tick 0
+    void start() {
+        next_tick = 0;
+        clock.running = true;
+    }
+
+    void resume() {
+        clock.running = true;
+    }
+
+    void stop() {
+        clock.running = false;
+    }
+
+    [[nodiscard]] const BeatClock& beat_clock() const { return clock; }
+    [[nodiscard]] const ClockStats& stats() const { return _stats; }
+    void reset_stats() {
+        _stats = { 0, 0, 0, 0, _stats.jitter_us, 0 };
+    }
+};
@@ -0,0 +1,110 @@
+// parses 5 pin din midi from a uart: running status, realtime bytes in the middle of other
+// messages, and sysex (handed over in pieces). TSource needs int available() and int read(),
+// so it works against a HardwareSerial or a stub on the host
+
+#pragma once
+
+#include <cstdint>
+
+#define DIN_SYSEX_CHUNK_LEN 64
+
+template<typename TSource>
+class DinIn {
+private:
+    TSource& source;
+    uint8_t status = 0; // running status, 0 until we've seen one
+    uint8_t data[2] = {};
+    uint8_t data_len = 0;
+    bool in_sysex = false;
+    uint8_t sysex[DIN_SYSEX_CHUNK_LEN];
+    uint8_t sysex_len = 0;
+
+    // data bytes that follow a status, by high nibble (0xF is handled separately)
+    static constexpr uint8_t channel_data_len[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 1, 1, 2, 0 };
+
+    static uint8_t expected(const uint8_t s) {
+        if(s < 0xF0) return channel_data_len[s >> 4];
+        if(s == 0xF2) return 2; // song position
+        if(s == 0xF1 || s == 0xF3) return 1; // mtc quarter frame, song select
+        return 0;
+    }
+
+public:
+    uint32_t errors = 0; // stray data bytes
+
+    explicit DinIn(TSource& source) : source(source) {}
+
+    // reads what's there. on_message(status, data1, data2) for every complete message,
+    // on_sysex(data, len, last) for each piece of a sysex (starting with 0xF0, the last ending with 0xF7).
+    // returns how many bytes were read
+    template<typename FMessage, typename FSysEx>
+    uint16_t poll(FMessage&& on_message, FSysEx&& on_sysex) {
+        uint16_t n = 0;
+        while(source.available() > 0) {
+            const uint8_t b = source.read();
+            n++;
+
+            if(b >= 0xF8) {
+                // realtime, can show up anywhere and doesn't touch running status
+                on_message(b, 0, 0);
+                continue;
+            }
+
+            if(in_sysex) {
+                if(b < 0x80 || b == 0xF7) {
+                    sysex[sysex_len++] = b;
+                    if(b == 0xF7) {
+                        on_sysex(sysex, sysex_len, true);
+                        sysex_len = 0;
+                        in_sysex = false;
+                    } else if(sysex_len == DIN_SYSEX_CHUNK_LEN) {
+                        on_sysex(sysex, sysex_len, false);
+                        sysex_len = 0;
+                    }
+                    continue;
+                }
+                // any other status ends it without an F7
+                sysex[sysex_len++] = 0xF7;
+                on_sysex(sysex, sysex_len, true);
+                sysex_len = 0;
+                in_sysex = false;
+            }
+
+            if(b == 0xF0) {
+                in_sysex = true;
+                status = 0;
+                sysex[sysex_len++] = b;
+                continue;
+            }
+
+            if(b & 0x80) {
+                data_len = 0;
+                if(b >= 0xF0) {
+                    // system common cancels running status
+                    status = 0;
+                    if(expected(b) == 0) {
+                        on_message(b, 0, 0);
+                    } else {
+                        status = b;
+                    }
+                } else {
+                    status = b;
+                }
+                continue;
+            }
+
+            if(status == 0) {
+                errors++;
+                continue;
+            }
+            data[data_len++] = b;
+            if(data_len == expected(status)) {
+                on_message(status, data[0], data_len > 1 ? data[1] : 0);
+                data_len = 0;
+                // system common doesn't run
+                if(status >= 0xF0) status = 0;
+            }
+        }
+        return n;
+    }
+};
@@ -0,0 +1,133 @@
+// 5 pin din midi out on a uart. messages go into a byte ring first and pump() moves as many as
+// the uart has room for, so the 31.25 kbaud link never blocks whoever is sending.
+// TSink only needs int availableForWrite() and write(uint8_t), so a HardwareSerial works and
+// so does a stub on the host (tools/din_out_test.cpp). the last OffReserve bytes of the ring are
+// only for note offs, so a full ring can't leave a note stuck
+
+#pragma once
+
+#include <cstdint>
+#include "util/spsc_queue.hpp"
+
+template<typename TSink, size_t Capacity = 256, size_t OffReserve = Capacity / 4>
+class DinOut {
+    static_assert(OffReserve < Capacity, "the note off reserve has to leave room for everything else");
+
+private:
+    TSink& sink;
+    SpscQueue<uint8_t, Capacity> ring;
+    uint8_t running_status = 0; // last status byte that went into the ring, 0 if the next message needs one
+
+public:
+    struct Stats {
+        uint32_t messages;
+        uint32_t bytes; // written to the sink
+        uint32_t running_status_saved; // status bytes left out
+        uint32_t dropped; // messages that didn't fit in the ring
+        uint32_t offs_dropped; // note offs that didn't fit even in the reserve
+        uint16_t max_depth; // bytes
+    };
+
+private:
+    Stats _stats = {};
+
+    [[nodiscard]] bool fits(const size_t need, const bool note_off) const {
+        return Capacity - ring.size() >= need + (note_off ? 0 : OffReserve);
+    }
+
+public:
+    explicit DinOut(TSink& sink) : sink(sink) {}
+
+    // a channel message, len is the number of data bytes (1 or 2). returns false if it didn't fit,
+    // never partially queues a message
+    bool send(const uint8_t status, const uint8_t data1, const uint8_t data2, const uint8_t len) {
+        const bool reuse_status = status == running_status;
+        const size_t need = len + (reuse_status ? 0 : 1);
+        const uint8_t type = status & 0xF0;
+        const bool off = type == 0x80 || (type == 0x90 && data2 == 0);
+        if(!fits(need, off)) {
+            _stats.dropped++;
+            if(off) _stats.offs_dropped++;
+            return false;
+        }
+        if(reuse_status) {
+            _stats.running_status_saved++;
+        } else {
+            ring.push(status);
+            // system common/sysex cancel running status, and only channel messages can use it
+            running_status = status < 0xF0 ? status : 0;
+        }
+        ring.push(data1);
+        if(len > 1) ring.push(data2);
+        _stats.messages++;
+
+        const size_t depth = ring.size();
+        if(depth > _stats.max_depth) _stats.max_depth = depth;
+        return true;
+    }
+
+    // clock and transport. can go between any two bytes, but we keep messages whole anyway
+    bool realtime(const uint8_t status) {
+        if(!fits(1, false)) {
+            _stats.dropped++;
+            return false;
+        }
+        ring.push(status);
+        _stats.messages++;
+        return true;
+    }
+
+    // raw bytes that aren't running status friendly: sysex pieces and system common.
+    // all or nothing like send()
+    bool raw(const uint8_t* bytes, const uint16_t len) {
+        if(!fits(len, false)) {
+            _stats.dropped++;
+            return false;
+        }
+        for(uint16_t i = 0; i < len; i++) ring.push(bytes[i]);
+        running_status = 0;
+        _stats.messages++;
+        const size_t depth = ring.size();
+        if(depth > _stats.max_depth) _stats.max_depth = depth;
+        return true;
+    }
+
+    bool note_on(const uint8_t channel, const uint8_t note, const uint8_t velocity) {
+        return send(0x90 | (channel - 1), note, velocity, 2);
+    }
+
+    // as a note on with velocity 0, so it can share running status with the note ons around it
+    bool note_off(const uint8_t channel, const uint8_t note) {
+        return send(0x90 | (channel - 1), note, 0, 2);
+    }
+
+    bool control_change(const uint8_t channel, const uint8_t control, const uint8_t value) {
+        return send(0xB0 | (channel - 1), control, value, 2);
+    }
+
+    bool pitch_bend(const uint8_t channel, const uint8_t lsb, const uint8_t msb) {
+        return send(0xE0 | (channel - 1), lsb, msb, 2);
+    }
+
+    bool channel_pressure(const uint8_t channel, const uint8_t pressure) {
+        return send(0xD0 | (channel - 1), pressure, 0, 1);
+    }
+
+    // move what the sink has room for out of the ring, returns how many bytes
+    uint16_t pump() {
+        uint16_t n = 0;
+        uint8_t b;
+        for(int room = sink.availableForWrite(); room > 0 && ring.pop(b); room--) {
+            sink.write(b);
+            n++;
+        }
+        _stats.bytes += n;
+        return n;
+    }
+
+    [[nodiscard]] size_t depth() const { return ring.size(); }
+    // bytes anything but a note off can still queue
+    [[nodiscard]] size_t room() const { return Capacity - ring.size() > OffReserve ? Capacity - ring.size() - OffReserve : 0; }
+    [[nodiscard]] Stats stats() const { return _stats; }
+    void reset_stats() { _stats = {}; }
+};
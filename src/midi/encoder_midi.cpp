@@ -0,0 +1,126 @@
+#include "encoder_midi.hpp"
+#include <algorithm>
+#include <Arduino.h>
+#include "hardware/midi.hpp"
+
+// general purpose controllers 1-4 (their lsbs are 48-51), one 7 bit step per increment
+static constexpr EncoderMapping default_mappings[INPUT_ENCODERS_LEN] = {
+    { EncoderMidiType::cc14, 1, 16, 128, 10 },
+    { EncoderMidiType::cc14, 1, 17, 128, 10 },
+    { EncoderMidiType::cc14, 1, 18, 128, 10 },
+    { EncoderMidiType::cc14, 1, 19, 128, 10 },
+    { EncoderMidiType::none, 0, 0, 0, 0 } // enc_ctrl is for the ui
+};
+
+// mpe expression (midi/mpe.cpp) has these while mpe is on
+constexpr uint8_t MPE_ENCODERS = 3;
+
+EncoderMidi::EncoderMidi() {
+    std::fill(selected_nrpn, selected_nrpn + 16, 0xFFFF);
+    for(uint8_t i = 0; i < INPUT_ENCODERS_LEN; i++) {
+        params[i].mapping = default_mappings[i];
+        params[i].sent = 0xFFFF;
+    }
+}
+
+void EncoderMidi::send(Param& p) {
+    const auto& m = p.mapping;
+    const uint8_t msb = p.value >> 7;
+    const uint8_t lsb = p.value & 0x7F;
+    const bool msb_changed = p.sent == 0xFFFF || p.sent >> 7 != msb;
+    const bool lsb_changed = p.sent == 0xFFFF || (p.sent & 0x7F) != lsb;
+    const auto cc = [&](const uint8_t control, const uint8_t value) {
+        Midi::send_expression({ Midi::EventType::control_change, m.channel, control, value });
+    };
+
+    switch(m.type) {
+        case EncoderMidiType::cc7:
+            if(!msb_changed) {
+                suppressed++;
+                return;
+            }
+            cc(m.number, msb);
+            break;
+        case EncoderMidiType::cc14:
+            // a new msb resets the receiver's lsb, so the lsb always follows it
+            if(msb_changed) cc(m.number, msb);
+            if(msb_changed || lsb_changed) cc(m.number + 32, lsb);
+            else {
+                suppressed++;
+                return;
+            }
+            break;
+        case EncoderMidiType::nrpn: {
+            auto& selected = selected_nrpn[m.channel - 1];
+            const bool reselect = selected != m.number;
+            if(!reselect && !msb_changed && !lsb_changed) {
+                suppressed++;
+                return;
+            }
+            if(reselect) {
+                cc(99, m.number >> 7);
+                cc(98, m.number & 0x7F);
+                selected = m.number;
+            }
+            if(reselect || msb_changed) cc(6, msb);
+            cc(38, lsb);
+            break;
+        }
+        default:
+            return;
+    }
+    Midi::send_expression({ Midi::EventType::flush, 0, 0, 0 });
+    p.sent = p.value;
+    sends++;
+}
+
+uint8_t EncoderMidi::deliver() {
+    Threads::Scope m(lock);
+    const uint32_t now = micros();
+    uint8_t n = 0;
+    for(auto& p : params) {
+        if(!p.pending || now - p.sent_at_us < p.mapping.interval_ms * 1000ul) continue;
+        p.pending = false;
+        p.sent_at_us = now;
+        send(p);
+        n++;
+    }
+    return n;
+}
+
+void EncoderMidi::init() {
+    input_stream.add_listener([this](const InputBatch& batch) {
+        Threads::Scope m(lock);
+        const bool mpe = Midi::mpe_enabled();
+        for(uint8_t i = 0; i < batch.len; i++) {
+            const auto& r = batch.records[i];
+            if(r.type != InputType::encoder || r.source >= INPUT_ENCODERS_LEN) continue;
+            if(mpe && r.source < MPE_ENCODERS) continue;
+            auto& p = params[r.source];
+            if(p.mapping.type == EncoderMidiType::none) continue;
+
+            p.value = std::clamp<int32_t>(p.value + r.value * p.mapping.step, 0, 0x3FFF);
+            if(p.pending) coalesced++;
+            p.pending = true;
+        }
+    });
+    event_pump.add(this);
+}
+
+void EncoderMidi::map(const uint8_t encoder, const EncoderMapping& mapping) {
+    if(encoder >= INPUT_ENCODERS_LEN) return;
+    Threads::Scope m(lock);
+    params[encoder].mapping = mapping;
+    params[encoder].sent = 0xFFFF;
+    params[encoder].pending = false;
+}
+
+void EncoderMidi::print_stats(const bool reset) {
+    Threads::Scope m(lock);
+    Serial.printf("encoder midi: %lu sends, %lu coalesced, %lu suppressed\n", sends, coalesced, suppressed);
+    if(reset) {
+        sends = 0;
+        coalesced = 0;
+        suppressed = 0;
+    }
+}
@@ -0,0 +1,60 @@
+// encoders to midi controllers. deltas from input_stream add up into a 14 bit value per
+// encoder, and each one sends at most once per interval_ms, only the bytes that changed.
+// so however fast an encoder spins, it costs at most 4 ccs per interval
+
+#pragma once
+
+#include <cstdint>
+#include "util/deferred_event.hpp"
+#include "input/input_stream.hpp"
+
+enum class EncoderMidiType : uint8_t {
+    none,
+    cc7,
+    cc14, // msb on number (0-31), lsb on number + 32
+    nrpn // number is the 14 bit parameter, assumes nothing else selects nrpns on the channel
+};
+
+struct EncoderMapping {
+    EncoderMidiType type;
+    uint8_t channel;
+    uint16_t number;
+    uint16_t step; // per encoder increment, out of 16383
+    uint8_t interval_ms;
+};
+
+class EncoderMidi : public DeferredEventBase {
+private:
+    struct Param {
+        EncoderMapping mapping;
+        uint16_t value; // 14 bits
+        uint16_t sent; // what the receiver has, 0xFFFF if it doesn't have anything from us
+        uint32_t sent_at_us;
+        bool pending;
+    };
+
+    Param params[INPUT_ENCODERS_LEN] = {};
+    // nrpn selected on each channel by our last send, 0xFFFF if none
+    uint16_t selected_nrpn[16];
+    Threads::Mutex lock;
+    uint32_t sends = 0;
+    uint32_t coalesced = 0; // encoder records that didn't cause a send of their own
+    uint32_t suppressed = 0; // sends skipped because the value hadn't changed
+
+    void send(Param& p);
+
+protected:
+    // sends whatever's pending and past its interval, the pump calls this every pass
+    uint8_t deliver() override;
+
+public:
+    EncoderMidi();
+
+    // adds the input_stream listener and adds itself to the event pump, so call before event_pump.init()
+    void init();
+    // any thread
+    void map(uint8_t encoder, const EncoderMapping& mapping);
+    void print_stats(bool reset);
+};
+
+inline EncoderMidi encoder_midi;
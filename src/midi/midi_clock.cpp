@@ -0,0 +1,63 @@
+#include "midi_clock.hpp"
+#include <atomic>
+#include <Arduino.h>
+#include <TeensyThreads.h>
+#include "hardware/midi.hpp"
+
+// only touched on the event pump
+static ClockPll pll;
+
+// the pump writes the buffer that isn't current and then bumps gen. a reader that sees gen change
+// while it was copying tries again. an interrupt can't be preempted by the pump, so it never has to
+static BeatClock published[2];
+static std::atomic<uint32_t> gen{0};
+static Threads::Mutex stats_lock;
+
+static void publish() {
+    const uint32_t g = gen.load(std::memory_order_relaxed);
+    published[(g + 1) & 1] = pll.beat_clock();
+    gen.store(g + 1, std::memory_order_release);
+}
+
+BeatClock midi_clock_now() {
+    while(true) {
+        const uint32_t g = gen.load(std::memory_order_acquire);
+        const BeatClock c = published[g & 1];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(gen.load(std::memory_order_relaxed) == g) return c;
+    }
+}
+
+void midi_clock_init() {
+    Midi::in_evt.add_listener([](const Midi::InMessage& msg) {
+        Threads::Scope m(stats_lock);
+        switch(msg.type) {
+            case Midi::InType::clock:
+                pll.tick(msg.ts);
+                break;
+            case Midi::InType::start:
+                pll.start();
+                break;
+            case Midi::InType::continue_:
+                pll.resume();
+                break;
+            case Midi::InType::stop:
+                pll.stop();
+                break;
+            default:
+                return;
+        }
+        publish();
+    });
+}
+
+void midi_clock_print_stats(const bool reset) {
+    Threads::Scope m(stats_lock);
+    const auto& s = pll.stats();
+    const auto c = pll.beat_clock();
+    Serial.printf("midi clock: %s, %s, %.2f bpm, tick %lu\n", c.running ? "running" : "stopped",
+        c.locked ? "locked" : "unlocked", c.bpm(), c.tick);
+    Serial.printf("  %lu ticks, jitter %.0f us (max %lu), %lu locks, %lu unlocks, %lu resyncs\n",
+        s.ticks, s.jitter_us, s.max_jitter_us, s.locks, s.unlocks, s.resyncs);
+    if(reset) pll.reset_stats();
+}
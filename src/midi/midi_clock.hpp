@@ -0,0 +1,11 @@
+// follows the host's midi clock (Midi::in_evt) with a ClockPll
+
+#pragma once
+
+#include "clock_pll.hpp"
+
+// adds the Midi::in_evt listener, so call before event_pump.init()
+void midi_clock_init();
+// the filtered clock, from any thread or interrupt
+BeatClock midi_clock_now();
+void midi_clock_print_stats(bool reset);
@@ -0,0 +1,114 @@
+#include "mpe.hpp"
+#include <algorithm>
+#include "hardware/midi.hpp"
+#include "input/input_stream.hpp"
+
+void MpeChannelAllocator::unlink(List& list, const uint8_t i) {
+    auto& s = slots[i];
+    if(s.prev == NIL) list.head = s.next;
+    else slots[s.prev].next = s.next;
+    if(s.next == NIL) list.tail = s.prev;
+    else slots[s.next].prev = s.prev;
+}
+
+void MpeChannelAllocator::push_back(List& list, const uint8_t i) {
+    auto& s = slots[i];
+    s.prev = list.tail;
+    s.next = NIL;
+    if(list.tail == NIL) list.head = i;
+    else slots[list.tail].next = i;
+    list.tail = i;
+}
+
+void MpeChannelAllocator::reset(const uint8_t member_count) {
+    members = std::min<uint8_t>(member_count, MPE_MAX_MEMBERS);
+    free_list = {};
+    active_list = {};
+    for(uint8_t i = 0; i < members; i++) {
+        slots[i].owner = NIL;
+        push_back(free_list, i);
+    }
+}
+
+MpeChannelAllocator::Allocation MpeChannelAllocator::allocate(const uint8_t owner) {
+    Allocation a = { 0, false, 0 };
+    uint8_t i = free_list.head;
+    if(i != NIL) {
+        unlink(free_list, i);
+    } else {
+        i = active_list.head;
+        unlink(active_list, i);
+        a.stolen = true;
+        a.stolen_owner = slots[i].owner;
+    }
+    slots[i].owner = owner;
+    push_back(active_list, i);
+    a.channel = MPE_MANAGER_CHANNEL + 1 + i;
+    return a;
+}
+
+bool MpeChannelAllocator::release(const uint8_t channel, const uint8_t owner) {
+    const uint8_t i = channel - MPE_MANAGER_CHANNEL - 1;
+    if(i >= members || slots[i].owner != owner) return false;
+    slots[i].owner = NIL;
+    unlink(active_list, i);
+    push_back(free_list, i);
+    return true;
+}
+
+// expression
+
+#define MPE_BEND_STEP 64 // per encoder increment, out of +-8192
+#define MPE_PRESSURE_STEP 4
+#define MPE_TIMBRE_STEP 4
+
+// what the encoders have done to the current note, only touched on the event pump
+static struct {
+    uint32_t note; // from Midi::mpe_last_note(), the values reset when it changes
+    int16_t bend;
+    int16_t pressure;
+    int16_t timbre;
+} expression = {};
+
+static void handle_encoder(const uint8_t encoder, const int16_t incs) {
+    const uint32_t note = Midi::mpe_last_note();
+    if(note == 0) return; // mpe is off, or nothing has played yet
+    if(note != expression.note) {
+        // the note on already sent these starting values
+        expression = { note, 0, static_cast<int16_t>(note >> 8 & 0x7F), 64 };
+    }
+    const uint8_t channel = note & 0xFF;
+
+    // incs is coalesced and can be big, so the sums are worked out in 32 bits before the clamp
+    switch(encoder) {
+        case 0: {
+            expression.bend = static_cast<int16_t>(std::clamp<int32_t>(expression.bend + incs * MPE_BEND_STEP, -8192, 8191));
+            const uint16_t value = expression.bend + 8192;
+            Midi::send_expression({ Midi::EventType::pitch_bend, channel,
+                static_cast<uint8_t>(value & 0x7F), static_cast<uint8_t>(value >> 7) });
+            break;
+        }
+        case 1:
+            expression.pressure = static_cast<int16_t>(std::clamp<int32_t>(expression.pressure + incs * MPE_PRESSURE_STEP, 0, 127));
+            Midi::send_expression({ Midi::EventType::channel_pressure, channel,
+                static_cast<uint8_t>(expression.pressure), 0 });
+            break;
+        case 2:
+            expression.timbre = static_cast<int16_t>(std::clamp<int32_t>(expression.timbre + incs * MPE_TIMBRE_STEP, 0, 127));
+            Midi::send_expression({ Midi::EventType::control_change, channel,
+                74, static_cast<uint8_t>(expression.timbre) });
+            break;
+        default:
+            return;
+    }
+    Midi::send_expression({ Midi::EventType::flush, 0, 0, 0 });
+}
+
+void mpe_expression_init() {
+    input_stream.add_listener([](const InputBatch& batch) {
+        for(uint8_t i = 0; i < batch.len; i++) {
+            const auto& r = batch.records[i];
+            if(r.type == InputType::encoder) handle_encoder(r.source, r.value);
+        }
+    });
+}
@@ -0,0 +1,57 @@
+// mpe (midi polyphonic expression): every sounding note gets a member channel of its own, so
+// pitch bend and pressure can be sent per note. this is the lower zone only, the manager is
+// channel 1 and the members are channels 2 and up
+
+#pragma once
+
+#include <cstdint>
+
+#define MPE_MANAGER_CHANNEL 1
+#define MPE_MAX_MEMBERS 15
+#define MPE_DEFAULT_BEND_RANGE 48 // what receivers assume for member channels unless told otherwise
+
+// hands out member channels least recently used first, and steals the oldest sounding note's
+// channel when they're all taken. everything is O(1), the lists are intrusive in a fixed array
+class MpeChannelAllocator {
+private:
+    static constexpr uint8_t NIL = 0xFF;
+
+    struct Slot {
+        uint8_t prev;
+        uint8_t next;
+        uint8_t owner; // whatever the caller passed to allocate(), NIL if free
+    };
+
+    struct List {
+        uint8_t head = NIL; // oldest
+        uint8_t tail = NIL; // newest
+    };
+
+    Slot slots[MPE_MAX_MEMBERS] = {};
+    List free_list; // ordered by when the channel was released, so release tails get to ring out
+    List active_list; // ordered by note on, the head is what gets stolen
+    uint8_t members = 0;
+
+    void unlink(List& list, uint8_t i);
+    void push_back(List& list, uint8_t i);
+
+public:
+    struct Allocation {
+        uint8_t channel;
+        bool stolen; // the caller has to turn off stolen_owner's note
+        uint8_t stolen_owner;
+    };
+
+    // free every channel, 0 members turns allocation off
+    void reset(uint8_t member_count);
+    [[nodiscard]] uint8_t member_count() const { return members; }
+
+    // member_count() has to be > 0
+    Allocation allocate(uint8_t owner);
+    // returns false if owner doesn't hold the channel anymore (it was stolen, or allocation was reset)
+    bool release(uint8_t channel, uint8_t owner);
+};
+
+// encoders 0-2 bend, press and change the timbre (cc 74) of the most recent note while mpe is on
+// adds an input_stream listener, so call before event_pump.init()
+void mpe_expression_init();
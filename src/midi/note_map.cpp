@@ -0,0 +1,45 @@
+#include "note_map.hpp"
+#include <cmath>
+#include <TeensyThreads.h>
+
+// the map that isn't current gets rebuilt, then becomes current. a reader could still be in
+// the middle of a lookup in it (from before the last swap), so the generation goes up around
+// the rewrite and the reader goes again if it changed
+static NoteMap buffers[2];
+static Threads::Mutex writer_lock;
+
+static NoteMap* begin_rebuild() {
+    note_map_detail::generation.fetch_add(1, std::memory_order_acq_rel);
+    return note_map_detail::current.load(std::memory_order_relaxed) == &buffers[0] ? &buffers[1] : &buffers[0];
+}
+
+static void end_rebuild(const NoteMap* next) {
+    note_map_detail::current.store(next, std::memory_order_release);
+    note_map_detail::generation.fetch_add(1, std::memory_order_release);
+}
+
+void note_map_reset() {
+    Threads::Scope m(writer_lock);
+    note_map_detail::current.store(&default_note_map, std::memory_order_release);
+}
+
+void note_map_configure(const NoteMapConfig& config) {
+    Threads::Scope m(writer_lock);
+    const auto next = begin_rebuild();
+    *next = make_note_map(config);
+    end_rebuild(next);
+}
+
+void note_map_load_preset(const float* frequencies, const NoteMapConfig& config) {
+    Threads::Scope m(writer_lock);
+    const auto next = begin_rebuild();
+    for(uint8_t i = 0; i < NOTE_KEYS_LEN; i++) {
+        if(frequencies[i] <= 0) {
+            next->keys[i] = { NOTE_UNMAPPED, config.channel };
+            continue;
+        }
+        const auto note = static_cast<int16_t>(lroundf(69 + 12 * log2f(frequencies[i] / 440.0f)));
+        next->keys[i] = make_mapping(config, note);
+    }
+    end_rebuild(next);
+}
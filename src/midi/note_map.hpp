@@ -0,0 +1,92 @@
+// resolves a key index (row * COLS_LEN + column, as the velocity module reports it) to a
+// midi note and channel through a flat table. the table is rebuilt off to the side and
+// swapped in with one atomic pointer store, so the note path never waits on a layout change
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "kscan/kscan_gpio_matrix.hpp"
+
+// the matrix has an upper and lower switch row per key row, and the last row is the ctrl keys
+#define NOTE_KEYS_LEN ((ROWS_LEN / 2) * COLS_LEN)
+#define NOTE_UNMAPPED 0xFF
+
+struct NoteMapping {
+    uint8_t note; // NOTE_UNMAPPED if the key doesn't play anything
+    uint8_t channel;
+};
+
+enum class NoteLayoutType : uint8_t {
+    chromatic, // +1 per column, +COLS_LEN per row (how notes were numbered before the note map existed)
+    wicki_hayden, // +2 per column, rows alternate +7 and +5 (odd rows are treated as shifted right half a key)
+    janko, // +2 per column, every other row +1, so each pair of rows is a full chromatic jankó row
+    preset // from a NoteLayout preset (files.hpp)
+};
+
+struct NoteMapConfig {
+    NoteLayoutType layout = NoteLayoutType::chromatic;
+    uint8_t base_note = 0; // note of row 0, column 0 before transposing
+    int8_t transpose = 0; // semitones
+    int8_t octave = 0;
+    uint8_t channel = 1;
+};
+
+struct NoteMap {
+    NoteMapping keys[NOTE_KEYS_LEN];
+};
+
+constexpr int16_t layout_offset(const NoteLayoutType layout, const uint8_t row, const uint8_t column) {
+    switch(layout) {
+        case NoteLayoutType::wicki_hayden:
+            return 2 * column + 12 * (row / 2) + 7 * (row % 2);
+        case NoteLayoutType::janko:
+            return 2 * column + row % 2;
+        default:
+            return row * COLS_LEN + column;
+    }
+}
+
+constexpr NoteMapping make_mapping(const NoteMapConfig& config, const int16_t offset) {
+    const int16_t note = config.base_note + offset + config.transpose + 12 * config.octave;
+    return { note < 0 || note > 127 ? static_cast<uint8_t>(NOTE_UNMAPPED) : static_cast<uint8_t>(note), config.channel };
+}
+
+// for the built in layouts (not preset)
+constexpr NoteMap make_note_map(const NoteMapConfig& config) {
+    NoteMap map = {};
+    for(uint8_t r = 0; r < ROWS_LEN / 2; r++) {
+        for(uint8_t c = 0; c < COLS_LEN; c++) {
+            map.keys[r * COLS_LEN + c] = make_mapping(config, layout_offset(config.layout, r, c));
+        }
+    }
+    return map;
+}
+
+inline constexpr NoteMap default_note_map = make_note_map({});
+
+namespace note_map_detail {
+    inline std::atomic<const NoteMap*> current{&default_note_map};
+    // bumped before and after every rebuild. two rebuilds in a row reuse the buffer that was
+    // current before the first, so a reader that still had it checks this and reads again
+    inline std::atomic<uint32_t> generation{0};
+}
+
+// called on the note path, never blocks (retries only if a rebuild finished while it read)
+inline NoteMapping note_map_lookup(const uint8_t key) {
+    if(key >= NOTE_KEYS_LEN) return { NOTE_UNMAPPED, 0 };
+    while(true) {
+        const uint32_t g = note_map_detail::generation.load(std::memory_order_acquire);
+        const NoteMapping m = note_map_detail::current.load(std::memory_order_acquire)->keys[key];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(note_map_detail::generation.load(std::memory_order_relaxed) == g) return m;
+    }
+}
+
+// go back to default_note_map
+void note_map_reset();
+// rebuild the map for a built in layout and swap it in
+void note_map_configure(const NoteMapConfig& config);
+// rebuild the map from the per key frequencies of a NoteLayout preset (rounded to the nearest note)
+// and swap it in. config.layout is ignored, base_note/transpose/octave are added on top
+void note_map_load_preset(const float* frequencies, const NoteMapConfig& config);
@@ -0,0 +1,401 @@
+#include "preset_transfer.hpp"
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cstring>
+#include "hardware/files.hpp"
+#include "hardware/midi.hpp"
+
+enum : uint8_t {
+    CMD_BEGIN = 0x01,
+    CMD_DATA = 0x02,
+    CMD_END = 0x03,
+    CMD_ABORT = 0x04,
+    CMD_ACK = 0x10,
+    CMD_NAK = 0x11,
+    CMD_DONE = 0x12
+};
+
+// crc32 (the zip/ethernet one), a nibble at a time so the table is tiny
+static constexpr uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, const uint8_t len) {
+    for(uint8_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0x0F] ^ crc >> 4;
+        crc = crc_table[(crc ^ data[i] >> 4) & 0x0F] ^ crc >> 4;
+    }
+    return crc;
+}
+
+static uint32_t read7(const uint8_t* bytes, const uint8_t count) {
+    uint32_t v = 0;
+    for(uint8_t i = 0; i < count; i++) v |= static_cast<uint32_t>(bytes[i] & 0x7F) << (7 * i);
+    return v;
+}
+
+// 8 bytes in (top bits, then 7 bytes) for every 7 out, returns how many came out
+static uint8_t unpack(const uint8_t* in, const uint8_t len, uint8_t* out) {
+    uint8_t n = 0;
+    for(uint8_t i = 0; i < len; i += 8) {
+        const uint8_t msbs = in[i];
+        for(uint8_t j = 1; j < 8 && i + j < len; j++) {
+            out[n++] = in[i + j] | (msbs >> (j - 1) & 1) << 7;
+        }
+    }
+    return n;
+}
+
+static bool valid_path(const char* path) {
+    if(path[0] == '\0' || path[0] == '/' || strstr(path, "..") != nullptr) return false;
+    for(const char* c = path; *c != '\0'; c++) {
+        if(*c < 0x20 || *c > 0x7E) return false;
+    }
+    return true;
+}
+
+void PresetTransfer::reply(const uint8_t command, const uint8_t* args, const uint8_t len) {
+    uint8_t out[MIDI_SYSEX_OUT_LEN];
+    uint8_t n = 0;
+    out[n++] = 0xF0;
+    out[n++] = TRANSFER_MANUFACTURER;
+    out[n++] = TRANSFER_DEVICE;
+    out[n++] = command;
+    uint8_t sum = command;
+    for(uint8_t i = 0; i < len; i++) {
+        out[n++] = args[i];
+        sum += args[i];
+    }
+    out[n++] = -sum & 0x7F;
+    out[n++] = 0xF7;
+    Midi::send_sysex(out, n);
+}
+
+uint8_t PresetTransfer::credit() const {
+    // data can't go ahead of the control ops still waiting
+    if(pending_len > 0) return 0;
+    return std::min<uint8_t>(TRANSFER_WINDOW, TRANSFER_BLOCKS - blocks.size());
+}
+
+void PresetTransfer::ack() {
+    const uint8_t c = credit();
+    const uint8_t args[3] = {
+        static_cast<uint8_t>(session.expected_seq & 0x7F), static_cast<uint8_t>(session.expected_seq >> 7), c
+    };
+    reply(CMD_ACK, args, 3);
+    session.acked_seq = session.expected_seq;
+    session.acked_credit = c;
+    session.last_ack_us = micros();
+}
+
+void PresetTransfer::nak(const TransferError reason) {
+    if(session.nak_sent) return;
+    const uint8_t args[3] = {
+        static_cast<uint8_t>(session.expected_seq & 0x7F), static_cast<uint8_t>(session.expected_seq >> 7),
+        static_cast<uint8_t>(reason)
+    };
+    reply(CMD_NAK, args, 3);
+    session.nak_sent = true;
+    naks++;
+}
+
+void PresetTransfer::finish(const TransferError result) {
+    const uint8_t args[1] = { static_cast<uint8_t>(result) };
+    reply(CMD_DONE, args, 1);
+    if(result == TransferError::ok) {
+        transfers++;
+        last_bytes = session.size;
+        last_us = micros() - session.started_us;
+        Serial.printf("preset transfer: %s, %lu bytes in %lu ms (%.1f KB/s)\n", path, last_bytes, last_us / 1000,
+            last_us == 0 ? 0.0 : last_bytes * 1e6 / 1024 / last_us);
+    } else {
+        failures++;
+        Serial.printf("ERR: preset transfer: %s failed (%d)\n", path, result);
+    }
+    session.active = false;
+}
+
+void PresetTransfer::push_op(const Block& b) {
+    // behind anything that's already waiting, the writer has to see them in order
+    if(pending_len == 0 && blocks.push(b)) return;
+    if(pending_len == TRANSFER_PENDING_OPS) {
+        // can't happen, see pending
+        Serial.printf("ERR: preset transfer: too many ops pending\n");
+        return;
+    }
+    pending[pending_len++] = b;
+}
+
+void PresetTransfer::push_op(const Op op) {
+    Block b;
+    b.op = op;
+    b.len = 0;
+    push_op(b);
+}
+
+// returns how many made it into blocks
+uint8_t PresetTransfer::push_pending() {
+    uint8_t n = 0;
+    while(n < pending_len && blocks.push(pending[n])) n++;
+    if(n == 0) return 0;
+    pending_len -= n;
+    memmove(pending, pending + n, pending_len * sizeof(Block));
+    return n;
+}
+
+void PresetTransfer::begin(const uint8_t* args, const uint8_t len) {
+    if(pending_len > 0) {
+        // the writer is still catching up on the last session, the host can retry
+        const uint8_t busy[1] = { static_cast<uint8_t>(TransferError::busy) };
+        reply(CMD_DONE, busy, 1);
+        return;
+    }
+    // starting again drops whatever was in progress, so the host can just retry a begin
+    if(session.active) push_op(Op::abort);
+    session = {};
+
+    if(len < 6 || len - 5 > TRANSFER_PATH_LEN) {
+        finish(TransferError::bad_request);
+        return;
+    }
+    const uint8_t path_len = len - 5;
+    memcpy(path, args + 5, path_len);
+    path[path_len] = '\0';
+    if(!valid_path(path) || sd == nullptr) {
+        finish(sd == nullptr ? TransferError::sd : TransferError::bad_request);
+        return;
+    }
+
+    Block b;
+    b.op = Op::open;
+    b.session = ++session_id;
+    b.len = path_len;
+    memcpy(b.data, path, path_len);
+    push_op(b);
+    session.active = true;
+    session.opening = true;
+    session.size = read7(args, 5);
+    session.crc = 0xFFFFFFFF;
+    session.started_us = session.last_msg_us = micros();
+}
+
+void PresetTransfer::data(const uint8_t* args, const uint8_t len) {
+    if(!session.active || session.opening || session.closing || len < 2) return;
+    const uint16_t seq = read7(args, 2);
+    if(seq != session.expected_seq) {
+        nak(TransferError::sequence);
+        return;
+    }
+
+    Block b;
+    b.op = Op::data;
+    b.len = unpack(args + 2, std::min<uint8_t>(len - 2, TRANSFER_BLOCK_LEN + TRANSFER_BLOCK_LEN / 7), b.data);
+    if(session.received + b.len > session.size) {
+        push_op(Op::abort);
+        finish(TransferError::size);
+        return;
+    }
+    if(pending_len > 0 || !blocks.push(b)) {
+        nak(TransferError::busy);
+        return;
+    }
+    session.crc = crc32_update(session.crc, b.data, b.len);
+    session.received += b.len;
+    session.expected_seq = (session.expected_seq + 1) & 0x3FFF;
+    session.nak_sent = false;
+}
+
+void PresetTransfer::end(const uint8_t* args, const uint8_t len) {
+    if(!session.active || session.opening || session.closing) return;
+    TransferError error = TransferError::ok;
+    if(len < 5) error = TransferError::bad_request;
+    else if(session.received != session.size) error = TransferError::size;
+    else if((session.crc ^ 0xFFFFFFFF) != read7(args, 5)) error = TransferError::crc;
+
+    if(error != TransferError::ok) {
+        push_op(Op::abort);
+        finish(error);
+        return;
+    }
+    push_op(Op::close);
+    session.closing = true;
+}
+
+// body is from the command to the checksum
+void PresetTransfer::handle(const uint8_t* body, const uint8_t len) {
+    uint8_t sum = 0;
+    for(uint8_t i = 0; i < len; i++) sum += body[i];
+    if((sum & 0x7F) != 0) {
+        if(session.active && body[0] == CMD_DATA) nak(TransferError::checksum);
+        return;
+    }
+
+    session.last_msg_us = micros();
+    const uint8_t* args = body + 1;
+    const uint8_t args_len = len - 2;
+    switch(body[0]) {
+        case CMD_BEGIN:
+            begin(args, args_len);
+            break;
+        case CMD_DATA:
+            data(args, args_len);
+            break;
+        case CMD_END:
+            end(args, args_len);
+            break;
+        case CMD_ABORT:
+            if(session.active) push_op(Op::abort);
+            session.active = false;
+            break;
+        default:
+            break;
+    }
+}
+
+uint8_t PresetTransfer::deliver() {
+    Threads::Scope m(lock);
+    const uint8_t pushed = push_pending();
+    if(!session.active) return pushed;
+    const uint32_t now = micros();
+
+    const uint16_t status = writer_state.load(std::memory_order_acquire);
+    const auto state = static_cast<WriterState>(status >> 8 == session_id ? status & 0xFF : 0);
+    if(state == WriterState::failed) {
+        push_op(Op::abort);
+        finish(TransferError::sd);
+        return 1;
+    }
+    // waiting on the writer returns 0 so the pump sleeps in between
+    if(session.opening) {
+        if(state != WriterState::open) return 0;
+        session.opening = false;
+        ack();
+        return 1;
+    }
+    if(session.closing) {
+        if(state != WriterState::done) return 0;
+        finish(TransferError::ok);
+        return 1;
+    }
+
+    if(now - session.last_msg_us > TRANSFER_TIMEOUT_MS * 1000ul) {
+        push_op(Op::abort);
+        finish(TransferError::timeout);
+        return 1;
+    }
+    // ack every data message, when a window that was full frees up, and now and then if the
+    // host is waiting on an ack that got lost
+    if(session.expected_seq != session.acked_seq || (session.acked_credit == 0 && credit() > 0)
+        || now - session.last_ack_us > TRANSFER_REACK_MS * 1000ul) {
+        ack();
+        return 1;
+    }
+    return 0;
+}
+
+void PresetTransfer::write_sector() {
+    if(sector_len == 0) return;
+    write_ok = write_ok && file.write(sector, sector_len) == sector_len;
+    sector_len = 0;
+}
+
+void PresetTransfer::set_state(const WriterState state) {
+    writer_state.store(writer_session << 8 | static_cast<uint8_t>(state), std::memory_order_release);
+}
+
+void PresetTransfer::write_block(const Block& b) {
+    if(b.op == Op::open) {
+        memcpy(writer_path, b.data, b.len);
+        writer_path[b.len] = '\0';
+    }
+    char part[TRANSFER_PATH_LEN + 6];
+    snprintf(part, sizeof(part), "%s.part", writer_path);
+
+    switch(b.op) {
+        case Op::open:
+            writer_session = b.session;
+            if(file) file.close();
+            file = sd->open(part, O_WRONLY | O_CREAT | O_TRUNC);
+            write_ok = static_cast<bool>(file);
+            sector_len = 0;
+            if(!write_ok) Serial.printf("ERR: preset transfer: couldn't open %s\n", part);
+            set_state(write_ok ? WriterState::open : WriterState::failed);
+            break;
+        case Op::data:
+            // whole sectors only until the end, the card is much faster that way
+            for(uint8_t i = 0; i < b.len; i++) {
+                sector[sector_len++] = b.data[i];
+                if(sector_len == TRANSFER_SECTOR_LEN) write_sector();
+            }
+            if(!write_ok) set_state(WriterState::failed);
+            break;
+        case Op::close:
+            write_sector();
+            write_ok = file.close() && write_ok;
+            if(write_ok && sd->exists(writer_path)) write_ok = sd->remove(writer_path);
+            write_ok = write_ok && sd->rename(part, writer_path);
+            if(!write_ok) Serial.printf("ERR: preset transfer: write to %s failed\n", writer_path);
+            set_state(write_ok ? WriterState::done : WriterState::failed);
+            break;
+        case Op::abort:
+            if(file) {
+                file.close();
+                sd->remove(part);
+            }
+            set_state(WriterState::idle);
+            break;
+    }
+}
+
+void PresetTransfer::thread_fn() {
+    while(true) {
+        Block b;
+        if(!blocks.pop(b)) {
+            threads.delay(1); // a transfer is never urgent
+            continue;
+        }
+        write_block(b);
+    }
+}
+
+void PresetTransfer::init() {
+    Midi::sysex_evt.add_listener([this](const Midi::SysExChunk& chunk) {
+        Threads::Scope m(lock);
+        // a new message always starts a new buffer, in case the end of the last one got dropped
+        if(chunk.len > 0 && chunk.data[0] == 0xF0) {
+            msg_len = 0;
+            msg_overflow = false;
+        }
+        if(msg_len + chunk.len > TRANSFER_MSG_LEN) {
+            msg_overflow = true;
+        } else {
+            memcpy(msg + msg_len, chunk.data, chunk.len);
+            msg_len += chunk.len;
+        }
+        if(!chunk.last) return;
+
+        // F0 7D 01 command checksum F7 at least
+        if(!msg_overflow && msg_len >= 6 && msg[0] == 0xF0 && msg[1] == TRANSFER_MANUFACTURER
+            && msg[2] == TRANSFER_DEVICE && msg[msg_len - 1] == 0xF7) {
+            handle(msg + 3, msg_len - 4);
+        }
+        msg_len = 0;
+        msg_overflow = false;
+    });
+    event_pump.add(this);
+    thread_init();
+}
+
+void PresetTransfer::print_stats(const bool reset) {
+    Threads::Scope m(lock);
+    Serial.printf("preset transfer: %lu done, %lu failed, %lu naks, last %lu bytes in %lu ms (%.1f KB/s)\n",
+        transfers, failures, naks, last_bytes, last_us / 1000,
+        last_us == 0 ? 0.0 : last_bytes * 1e6 / 1024 / last_us);
+    if(reset) {
+        transfers = 0;
+        failures = 0;
+        naks = 0;
+    }
+}
@@ -0,0 +1,158 @@
+// preset files (note layouts etc) over usb sysex, so they don't need the sd card pulled. the
+// host streams a file in small data messages, each one acked, and a writer thread puts them on
+// the sd card a sector at a time, so nothing bigger than a few blocks is ever in ram and a slow
+// card never holds up the event pump
+//
+// every message is F0 7D 01 <command> <args...> <checksum> F7. the checksum makes the sum of
+// everything from the command to it 0 (mod 128). numbers are 7 bits a byte, lowest first
+//
+// host -> us
+//   01 begin: size (5 bytes), path (ascii, relative to the sd card root, no "..")
+//   02 data:  seq (2 bytes, from 0, wraps at 16384), file bytes packed 7 to 8 (a byte with the
+//             top bits of the next 7, bit 0 first, then those 7 without them)
+//   03 end:   crc32 of the whole file (5 bytes)
+//   04 abort
+// us -> host
+//   10 ack:  seq (2 bytes) of the next data message we want, credit (1 byte). the host can send
+//            up to seq + credit - 1 without waiting. the ack for begin is seq 0
+//   11 nak:  seq (2 bytes) to go back to, reason (TransferError). sent once per seq
+//   12 done: TransferError (0 is ok), after end once the file is on the card. before that the
+//            file is written to <path>.part, so a failed transfer never replaces a good preset
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <SdFat.h>
+#include "util/deferred_event.hpp"
+#include "util/spsc_queue.hpp"
+#include "util/thread.hpp"
+
+#define TRANSFER_MANUFACTURER 0x7D // non-commercial
+#define TRANSFER_DEVICE 0x01
+#define TRANSFER_MSG_LEN 160 // longest message we put back together from usb sysex pieces
+#define TRANSFER_BLOCK_LEN 98 // file bytes per data message, 112 once packed
+#define TRANSFER_BLOCKS 8 // blocks between the event pump and the writer thread
+#define TRANSFER_PENDING_OPS 4 // control ops waiting for room in the blocks queue
+#define TRANSFER_WINDOW 3 // at most this much credit, so a window of data fits in Midi::sysex_evt
+#define TRANSFER_PATH_LEN 48
+#define TRANSFER_SECTOR_LEN 512
+#define TRANSFER_REACK_MS 100 // ack again if the host has gone quiet
+#define TRANSFER_TIMEOUT_MS 5000 // and give up on it after this
+
+enum class TransferError : uint8_t {
+    ok,
+    checksum, // a message didn't add up
+    sequence, // a data message was missed
+    busy, // the host sent past its credit, or began while the last session was still being cleaned up
+    bad_request, // bad path or size, or a message that doesn't belong in this state
+    size, // more or fewer bytes than begin said
+    crc, // the whole file didn't match
+    sd, // couldn't open/write/rename on the card
+    timeout // the host went quiet for TRANSFER_TIMEOUT_MS
+};
+
+class PresetTransfer : public DeferredEventBase, public Thread<PresetTransfer> {
+private:
+    enum class Op : uint8_t {
+        open,
+        data,
+        close,
+        abort
+    };
+
+    struct Block {
+        Op op;
+        uint8_t session; // open only
+        uint8_t len;
+        uint8_t data[TRANSFER_BLOCK_LEN]; // file bytes, or the path for open
+    };
+    static_assert(TRANSFER_PATH_LEN <= TRANSFER_BLOCK_LEN, "the path has to fit in the open block");
+
+    enum class WriterState : uint8_t {
+        idle,
+        open,
+        done,
+        failed
+    };
+
+    // event pump -> writer thread
+    SpscQueue<Block, TRANSFER_BLOCKS> blocks;
+    // session << 8 | WriterState, so a state left over from the last session is never mistaken for this one's
+    std::atomic<uint16_t> writer_state{0};
+
+    // writer thread only
+    FsFile file;
+    char writer_path[TRANSFER_PATH_LEN + 1] = {}; // from the open block
+    uint8_t sector[TRANSFER_SECTOR_LEN];
+    uint16_t sector_len = 0;
+    bool write_ok = false;
+    uint8_t writer_session = 0;
+
+    // event pump only
+    char path[TRANSFER_PATH_LEN + 1] = {}; // for the messages, the writer has its own copy
+    // control ops that didn't fit in blocks yet, in order. deliver() moves them over, so the pump
+    // never waits on the writer. begin waits for this to be empty, after which a session can add
+    // at most four (an abort and an open, then a close and an abort)
+    Block pending[TRANSFER_PENDING_OPS];
+    uint8_t pending_len = 0;
+    uint8_t msg[TRANSFER_MSG_LEN];
+    uint8_t msg_len = 0;
+    bool msg_overflow = false;
+
+    struct Session {
+        bool active;
+        bool opening; // begin acked once the writer has the file open
+        bool closing; // done sent once the writer has renamed it
+        uint32_t size;
+        uint32_t received;
+        uint32_t crc;
+        uint16_t expected_seq;
+        uint16_t acked_seq;
+        uint8_t acked_credit;
+        bool nak_sent; // for expected_seq
+        uint32_t started_us;
+        uint32_t last_msg_us;
+        uint32_t last_ack_us;
+    };
+    Session session = {};
+    uint8_t session_id = 0;
+
+    Threads::Mutex lock; // session and stats, against print_stats
+    uint32_t transfers = 0;
+    uint32_t failures = 0;
+    uint32_t naks = 0;
+    uint32_t last_bytes = 0;
+    uint32_t last_us = 0;
+
+    void handle(const uint8_t* body, uint8_t len);
+    void begin(const uint8_t* args, uint8_t len);
+    void data(const uint8_t* args, uint8_t len);
+    void end(const uint8_t* args, uint8_t len);
+    void push_op(const Block& b);
+    void push_op(Op op);
+    uint8_t push_pending();
+    void reply(uint8_t command, const uint8_t* args, uint8_t len);
+    void ack();
+    void nak(TransferError reason);
+    void finish(TransferError result);
+    [[nodiscard]] uint8_t credit() const;
+
+    [[noreturn]] void thread_fn();
+    void write_block(const Block& b);
+    void write_sector();
+    void set_state(WriterState state);
+    friend class Thread<PresetTransfer>;
+
+protected:
+    // acks, begin/end results from the writer, timeouts. the pump calls this every pass
+    uint8_t deliver() override;
+
+public:
+    // adds the Midi::sysex_evt listener, adds itself to the event pump and starts the writer
+    // thread, so call before event_pump.init()
+    void init();
+    void print_stats(bool reset);
+};
+
+inline PresetTransfer preset_transfer;
@@ -0,0 +1,434 @@
+#include "recorder.hpp"
+#include <algorithm>
+#include <Arduino.h>
+#include <TeensyThreads.h>
+#include "hardware/files.hpp"
+#include "hardware/midi.hpp"
+#include "input/input_stream.hpp"
+#include "midi/note_map.hpp"
+#include "scheduler/scheduler.hpp"
+
+// playback runs ahead of nothing on the key path, behind kscan and velocity
+#define RECORDER_SCHEDULER_PRIORITY 0
+
+// format: for each event a varint (7 bits per byte, low bits first, high bit set on all but the
+// last) of microseconds since the previous event, then a status byte (0x90 | channel - 1 for a
+// note on, 0x80 | channel - 1 for a note off) if it's different from the last one, then the note,
+// then for note ons the 8 bit velocity
+
+struct Chunk {
+    uint8_t data[RECORDER_CHUNK_LEN];
+};
+EXTMEM static Chunk pool[RECORDER_CHUNKS];
+
+// chunks in recording order, and the ones that aren't in it. only one recording for now, but
+// this way more can share the pool later
+static uint16_t chunk_table[RECORDER_CHUNKS];
+static uint16_t chunks_used = 0;
+static uint16_t free_chunks[RECORDER_CHUNKS];
+static uint16_t free_len = 0;
+
+static uint32_t len = 0; // bytes
+static uint32_t events = 0;
+static uint32_t loop_us = 0;
+static uint32_t overflows = 0;
+
+static Threads::Mutex lock;
+static RecorderState state = RecorderState::idle;
+// an export is reading the chunks without the lock, so they can't be freed or written
+static bool exporting = false;
+
+// recording
+static uint32_t record_start = 0;
+static uint32_t last_ts = 0; // relative to record_start
+static uint8_t last_status = 0;
+static NoteMapping recorded[NOTE_KEYS_LEN]; // what each key's note on was recorded as
+
+// playback
+struct Cursor {
+    uint32_t pos;
+    uint32_t next_at; // relative to the start of the loop, of the event at pos
+    uint8_t status;
+};
+static Cursor cursor;
+static bool looping = false;
+static uint32_t loop_start = 0;
+static uint8_t generation = 0; // jobs from an earlier play()/stop() don't do anything
+static JobHandle job;
+static uint32_t sounding[16][4]; // playback notes that are on, by channel
+
+static void playback_work(const uint8_t& gen);
+static auto scheduler = Scheduler("recorder", RECORDER_SCHEDULER_PRIORITY, playback_work);
+
+// buffer
+
+static void clear() {
+    for(uint16_t i = 0; i < chunks_used; i++) free_chunks[free_len++] = chunk_table[i];
+    chunks_used = 0;
+    len = 0;
+    events = 0;
+}
+
+static bool append(const uint8_t b) {
+    if(len % RECORDER_CHUNK_LEN == 0) {
+        if(free_len == 0) return false;
+        chunk_table[chunks_used++] = free_chunks[--free_len];
+    }
+    pool[chunk_table[len / RECORDER_CHUNK_LEN]].data[len % RECORDER_CHUNK_LEN] = b;
+    len++;
+    return true;
+}
+
+// the export reads through its own copy of the table, everything else through chunk_table
+static uint8_t at(const uint16_t* table, const uint32_t pos) {
+    return pool[table[pos / RECORDER_CHUNK_LEN]].data[pos % RECORDER_CHUNK_LEN];
+}
+
+static uint8_t at(const uint32_t pos) {
+    return at(chunk_table, pos);
+}
+
+static uint32_t read_varint(const uint16_t* table, const uint32_t end, uint32_t& pos) {
+    uint32_t v = 0;
+    for(uint8_t shift = 0; pos < end; shift += 7) {
+        const uint8_t b = at(table, pos++);
+        v |= (b & 0x7F) << shift;
+        if(!(b & 0x80)) break;
+    }
+    return v;
+}
+
+static uint32_t read_varint(uint32_t& pos) {
+    return read_varint(chunk_table, len, pos);
+}
+
+// recording, with lock held
+
+static void record(const uint32_t ts, const uint8_t status, const uint8_t note, const uint8_t velocity) {
+    // worst case: 5 byte varint, status, note, velocity
+    if(free_len * RECORDER_CHUNK_LEN + (chunks_used * RECORDER_CHUNK_LEN - len) < 8) {
+        overflows++;
+        return;
+    }
+    uint32_t delta = ts - last_ts;
+    last_ts = ts;
+    while(delta >= 0x80) {
+        append(0x80 | (delta & 0x7F));
+        delta >>= 7;
+    }
+    append(delta);
+    if(status != last_status) {
+        append(status);
+        last_status = status;
+    }
+    append(note);
+    if((status & 0xF0) == 0x90) append(velocity);
+    events++;
+}
+
+static void record_input(const InputRecord& r) {
+    const int32_t ts = r.ts - record_start;
+    if(ts < 0) return; // from before we started
+    const uint8_t key = r.source;
+    if(key >= NOTE_KEYS_LEN) return;
+
+    if(r.type == InputType::note_on) {
+        const auto m = note_map_lookup(key);
+        if(m.note == NOTE_UNMAPPED) return;
+        recorded[key] = m;
+        record(ts, 0x90 | (m.channel - 1), m.note, r.value);
+    } else if(recorded[key].note != NOTE_UNMAPPED) {
+        record(ts, 0x80 | (recorded[key].channel - 1), recorded[key].note, 0);
+        recorded[key].note = NOTE_UNMAPPED;
+    }
+}
+
+// playback, on the timer service (or the executive)
+
+static void set_sounding(const uint8_t channel, const uint8_t note, const bool on) {
+    auto& word = sounding[channel][note / 32];
+    if(on) word |= 1ul << (note % 32);
+    else word &= ~(1ul << (note % 32));
+}
+
+static void all_notes_off() {
+    for(uint8_t ch = 0; ch < 16; ch++) {
+        for(uint8_t note = 0; note < 128; note++) {
+            if(!(sounding[ch][note / 32] & 1ul << (note % 32))) continue;
+            Midi::play({ Midi::EventType::note_off, static_cast<uint8_t>(ch + 1), note, 0 });
+        }
+        std::fill(sounding[ch], sounding[ch] + 4, 0);
+    }
+}
+
+static void rewind() {
+    cursor = { 0, 0, 0 };
+    cursor.next_at = read_varint(cursor.pos);
+}
+
+static void play_due() {
+    // every event at this time in one go
+    while(cursor.pos < len) {
+        const uint8_t b = at(cursor.pos);
+        if(b & 0x80) {
+            cursor.status = b;
+            cursor.pos++;
+        }
+        const uint8_t note = at(cursor.pos++);
+        const uint8_t channel = (cursor.status & 0x0F) + 1;
+        if((cursor.status & 0xF0) == 0x90) {
+            const uint8_t velocity = at(cursor.pos++);
+            Midi::play({ Midi::EventType::note_on, channel, note, velocity });
+            set_sounding(channel - 1, note, true);
+        } else {
+            Midi::play({ Midi::EventType::note_off, channel, note, 0 });
+            set_sounding(channel - 1, note, false);
+        }
+
+        if(cursor.pos >= len) break;
+        const uint32_t delta = read_varint(cursor.pos);
+        cursor.next_at += delta;
+        if(delta != 0) break;
+    }
+}
+
+static void playback_work(const uint8_t& gen) {
+    {
+        Threads::Scope m(lock);
+        if(gen != generation) return;
+
+        if(state != RecorderState::playing) {
+            // stop() asked us to clean up
+            all_notes_off();
+        } else {
+            play_due();
+            uint32_t next = loop_start + cursor.next_at;
+            if(cursor.pos >= len) {
+                if(looping) {
+                    loop_start += loop_us;
+                    rewind();
+                    next = loop_start + cursor.next_at;
+                } else {
+                    all_notes_off();
+                    state = RecorderState::idle;
+                    next = 0;
+                }
+            }
+            if(state == RecorderState::playing) {
+                job = scheduler.schedule_at(next, micros(), generation);
+            }
+        }
+    }
+    Midi::flush();
+}
+
+// api
+
+bool recorder_record() {
+    Threads::Scope m(lock);
+    if(exporting) return false;
+    if(state == RecorderState::playing) {
+        scheduler.cancel(job);
+        job = scheduler.schedule(0, ++generation); // just to turn off what's sounding
+    }
+    clear();
+    for(auto& r : recorded) r.note = NOTE_UNMAPPED;
+    record_start = micros();
+    last_ts = 0;
+    last_status = 0;
+    state = RecorderState::recording;
+    return true;
+}
+
+void recorder_stop() {
+    Threads::Scope m(lock);
+    if(state == RecorderState::recording) {
+        const uint32_t ts = micros() - record_start;
+        // close notes that are still held, so the loop doesn't leave anything hanging
+        for(auto& r : recorded) {
+            if(r.note == NOTE_UNMAPPED) continue;
+            record(ts, 0x80 | (r.channel - 1), r.note, 0);
+            r.note = NOTE_UNMAPPED;
+        }
+        loop_us = std::max<uint32_t>(ts, 1);
+    } else if(state == RecorderState::playing) {
+        scheduler.cancel(job);
+        job = scheduler.schedule(0, ++generation);
+    }
+    state = RecorderState::idle;
+}
+
+bool recorder_play(const bool loop) {
+    Threads::Scope m(lock);
+    if(state == RecorderState::recording || len == 0) return false;
+    scheduler.cancel(job);
+    looping = loop;
+    rewind();
+    loop_start = micros();
+    state = RecorderState::playing;
+    job = scheduler.schedule(cursor.next_at, ++generation);
+    return true;
+}
+
+RecorderState recorder_state() {
+    Threads::Scope m(lock);
+    return state;
+}
+
+void recorder_init() {
+    for(uint16_t i = 0; i < RECORDER_CHUNKS; i++) free_chunks[free_len++] = RECORDER_CHUNKS - 1 - i;
+    for(auto& r : recorded) r.note = NOTE_UNMAPPED;
+    scheduler.init();
+
+    input_stream.add_listener([](const InputBatch& batch) {
+        Threads::Scope m(lock);
+        if(state != RecorderState::recording) return;
+        for(uint8_t i = 0; i < batch.len; i++) {
+            const auto& r = batch.records[i];
+            if(r.type == InputType::note_on || r.type == InputType::note_off) record_input(r);
+        }
+    });
+}
+
+void recorder_poll() {
+    scheduler.run_all_due();
+}
+
+// standard midi file export
+
+// 500 ticks per quarter note at 120 bpm, so a tick is a millisecond
+#define SMF_DIVISION 500
+#define SMF_TEMPO_US 500'000
+
+class SmfWriter {
+    FsFile& file;
+    uint8_t buf[512];
+    uint16_t buf_len = 0;
+
+public:
+    bool ok = true;
+    uint32_t written = 0;
+
+    explicit SmfWriter(FsFile& file) : file(file) {}
+
+    void byte(const uint8_t b) {
+        buf[buf_len++] = b;
+        written++;
+        if(buf_len == sizeof(buf)) flush();
+    }
+
+    void be(const uint32_t v, const uint8_t bytes) {
+        for(int8_t i = bytes - 1; i >= 0; i--) byte(v >> (i * 8));
+    }
+
+    // smf variable length quantities are big endian, unlike our varints
+    void vlq(const uint32_t v) {
+        uint8_t groups[5];
+        uint8_t n = 0;
+        uint32_t rest = v;
+        do {
+            groups[n++] = rest & 0x7F;
+            rest >>= 7;
+        } while(rest != 0);
+        while(n > 1) byte(groups[--n] | 0x80);
+        byte(groups[0]);
+    }
+
+    void flush() {
+        if(buf_len == 0) return;
+        ok = ok && file.write(buf, buf_len) == buf_len;
+        buf_len = 0;
+    }
+};
+
+static bool write_smf(FsFile& file, const uint16_t* table, const uint32_t end, const uint32_t loop) {
+    SmfWriter w(file);
+    w.be(0x4D546864, 4); // MThd
+    w.be(6, 4);
+    w.be(0, 2); // format 0
+    w.be(1, 2); // one track
+    w.be(SMF_DIVISION, 2);
+    w.be(0x4D54726B, 4); // MTrk
+    w.be(0, 4); // length, filled in at the end
+    const uint32_t track_start = w.written;
+
+    w.vlq(0);
+    w.byte(0xFF);
+    w.byte(0x51);
+    w.byte(3);
+    w.be(SMF_TEMPO_US, 3);
+
+    uint32_t pos = 0;
+    uint32_t t_us = 0;
+    uint32_t last_tick = 0;
+    uint8_t status = 0;
+    uint8_t last_status = 0;
+    while(pos < end) {
+        t_us += read_varint(table, end, pos);
+        if(at(table, pos) & 0x80) status = at(table, pos++);
+        const uint8_t note = at(table, pos++);
+        const bool on = (status & 0xF0) == 0x90;
+        const uint8_t velocity = on ? std::max<uint8_t>(at(table, pos++) >> 1, 1) : 0;
+
+        const uint32_t tick = t_us / (SMF_TEMPO_US / SMF_DIVISION);
+        w.vlq(tick - last_tick);
+        last_tick = tick;
+        if(status != last_status) {
+            w.byte(status);
+            last_status = status;
+        }
+        w.byte(note);
+        w.byte(on ? velocity : 0x40);
+    }
+
+    w.vlq(loop / (SMF_TEMPO_US / SMF_DIVISION) - last_tick);
+    w.byte(0xFF);
+    w.byte(0x2F);
+    w.byte(0);
+    w.flush();
+
+    const uint32_t track_len = w.written - track_start;
+    const uint8_t len_bytes[4] = {
+        static_cast<uint8_t>(track_len >> 24), static_cast<uint8_t>(track_len >> 16),
+        static_cast<uint8_t>(track_len >> 8), static_cast<uint8_t>(track_len)
+    };
+    return w.ok && file.seekSet(track_start - 4) && file.write(len_bytes, 4) == 4;
+}
+
+// the sd writes can take a while, so this only holds the lock to copy the chunk list. playback
+// keeps going meanwhile, but recorder_record() is refused until it's done
+bool recorder_export(const char* path) {
+    static uint16_t table[RECORDER_CHUNKS]; // only one export at a time, see exporting
+    uint32_t end;
+    uint32_t loop;
+    {
+        Threads::Scope m(lock);
+        if(state == RecorderState::recording || len == 0 || exporting) return false;
+        std::copy(chunk_table, chunk_table + chunks_used, table);
+        end = len;
+        loop = loop_us;
+        exporting = true;
+    }
+
+    bool ok = false;
+    if(sd == nullptr) {
+        Serial.printf("ERR: recorder export: no sd card\n");
+    } else if(auto file = sd->open(path, O_WRONLY | O_CREAT | O_TRUNC)) {
+        ok = write_smf(file, table, end, loop);
+        file.close();
+        if(!ok) Serial.printf("ERR: recorder export: write to %s failed\n", path);
+    } else {
+        Serial.printf("ERR: recorder export: couldn't open %s\n", path);
+    }
+
+    Threads::Scope m(lock);
+    exporting = false;
+    return ok;
+}
+
+void recorder_print_stats() {
+    Threads::Scope m(lock);
+    Serial.printf("recorder: %lu events in %lu bytes (%.1f per event), %d/%d chunks, %lu ms loop, %lu dropped\n",
+        events, len, events == 0 ? 0.0 : static_cast<double>(len) / events, chunks_used, RECORDER_CHUNKS,
+        loop_us / 1000, overflows);
+}
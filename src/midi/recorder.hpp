@@ -0,0 +1,38 @@
+// phrase recorder/looper. records the notes played (input_stream note records through the note
+// map) as varint time deltas and running status into chunks in psram, plays them back on the
+// timer service at the recorded times, and can export the recording as a standard midi file
+//
+// the times are recorded to the us, but playback is only as good as the timer service (or the
+// executive's recorder slot): a job runs when that thread next gets a round robin slice, so
+// events can go out up to a few slices late, unlike the arp's hardware timer. the "recorder"
+// scheduler's lateness histogram in the timer service stats shows how late they really were
+
+#pragma once
+
+#include <cstdint>
+
+#define RECORDER_CHUNK_LEN 4096
+#define RECORDER_CHUNKS 256 // 1 MB of psram
+
+enum class RecorderState : uint8_t {
+    idle,
+    recording,
+    playing
+};
+
+// adds the input_stream listener and the playback scheduler, so call before event_pump.init()
+// and before the timer service/executive start
+void recorder_init();
+// any thread. recording throws away the previous recording and stops playback. returns false
+// if an export is still writing the previous one out
+bool recorder_record();
+// end recording (the loop is as long as the recording ran) or playback
+void recorder_stop();
+// returns false if there's nothing recorded
+bool recorder_play(bool loop = true);
+RecorderState recorder_state();
+// write the recording to path on the sd card as a format 0 standard midi file, returns false on error
+bool recorder_export(const char* path);
+// playback jobs, for the cyclic executive
+void recorder_poll();
+void recorder_print_stats();
@@ -0,0 +1,128 @@
+// which midi goes where. routes are (from, to, channels, message types) and get compiled into a
+// table indexed by source port, message type and destination, so deciding where a message goes
+// is a couple of array reads. the table is swapped in whole, like the note map, so the sender
+// never waits on a route change
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "util/latency.hpp"
+
+#define MIDI_ROUTES_LEN 8
+
+enum class MidiPort : uint8_t {
+    local, // keys, arp, recorder, encoders
+    usb,
+    din,
+    COUNT
+};
+constexpr uint8_t MIDI_PORTS = static_cast<uint8_t>(MidiPort::COUNT);
+
+constexpr uint8_t port_bit(const MidiPort port) {
+    return 1 << static_cast<uint8_t>(port);
+}
+
+// message types for filters
+enum MidiTypeBit : uint8_t {
+    MIDI_TYPE_NOTE = 1 << 0,
+    MIDI_TYPE_POLY_PRESSURE = 1 << 1,
+    MIDI_TYPE_CONTROL = 1 << 2, // includes rpn/nrpn and mpe setup
+    MIDI_TYPE_PROGRAM = 1 << 3,
+    MIDI_TYPE_CHANNEL_PRESSURE = 1 << 4,
+    MIDI_TYPE_PITCH_BEND = 1 << 5,
+    MIDI_TYPE_SYSTEM = 1 << 6, // clock, transport, song position, etc
+    MIDI_TYPE_SYSEX = 1 << 7,
+    MIDI_TYPE_ALL = 0xFF
+};
+constexpr uint8_t MIDI_TYPES = 8;
+
+// type bit for a status byte, by high nibble
+inline constexpr uint8_t midi_type_bits[16] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    MIDI_TYPE_NOTE, MIDI_TYPE_NOTE, MIDI_TYPE_POLY_PRESSURE, MIDI_TYPE_CONTROL,
+    MIDI_TYPE_PROGRAM, MIDI_TYPE_CHANNEL_PRESSURE, MIDI_TYPE_PITCH_BEND, MIDI_TYPE_SYSTEM
+};
+
+constexpr uint8_t midi_type_bit(const uint8_t status) {
+    return status == 0xF0 || status == 0xF7 ? static_cast<uint8_t>(MIDI_TYPE_SYSEX) : midi_type_bits[status >> 4];
+}
+
+struct MidiRoute {
+    MidiPort from;
+    MidiPort to;
+    uint16_t channels; // bit n is channel n + 1, system messages and sysex ignore it
+    uint8_t types; // MidiTypeBits
+};
+
+class MidiRouter {
+private:
+    struct Table {
+        // [from][type][to]: channels that pass. system types use bit 0
+        uint16_t accept[MIDI_PORTS][MIDI_TYPES][MIDI_PORTS];
+    };
+
+    Table tables[2] = {};
+    std::atomic<const Table*> current{&tables[0]};
+    // bumped before and after every rebuild. two rebuilds in a row reuse the table that was
+    // current before the first, so a lookup that still had it checks this and reads again
+    std::atomic<uint32_t> generation{0};
+    MidiRoute routes[MIDI_ROUTES_LEN] = {};
+    uint8_t routes_len = 0;
+
+    void rebuild() {
+        generation.fetch_add(1, std::memory_order_acq_rel);
+        const auto next = current.load(std::memory_order_relaxed) == &tables[0] ? &tables[1] : &tables[0];
+        *next = {};
+        for(uint8_t i = 0; i < routes_len; i++) {
+            const auto& r = routes[i];
+            if(r.from == r.to) continue; // no loops
+            for(uint8_t t = 0; t < MIDI_TYPES; t++) {
+                if(!(r.types & 1 << t)) continue;
+                const bool channelless = 1 << t == MIDI_TYPE_SYSTEM || 1 << t == MIDI_TYPE_SYSEX;
+                next->accept[static_cast<uint8_t>(r.from)][t][static_cast<uint8_t>(r.to)] |= channelless ? 1 : r.channels;
+            }
+        }
+        current.store(next, std::memory_order_release);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+
+public:
+    // pass through latency by [from][to], only touched by the thread that routes
+    LatencyHistogram latency[MIDI_PORTS][MIDI_PORTS] = {};
+    uint32_t routed[MIDI_PORTS][MIDI_PORTS] = {};
+
+    // not thread safe against each other, only against destinations()
+    bool add(const MidiRoute& route) {
+        if(routes_len == MIDI_ROUTES_LEN) return false;
+        routes[routes_len++] = route;
+        rebuild();
+        return true;
+    }
+
+    void clear() {
+        routes_len = 0;
+        rebuild();
+    }
+
+    // port_bits of where a message from from should go. channel is 1-16 (anything else goes nowhere),
+    // ignored for system messages. never blocks, retries only if a rebuild finished while it read
+    [[nodiscard]] uint8_t destinations(const MidiPort from, const uint8_t status, const uint8_t channel) const {
+        const uint8_t type = midi_type_bit(status);
+        if(type == 0) return 0;
+        const uint8_t t = __builtin_ctz(type);
+        const bool channel_voice = !(type & (MIDI_TYPE_SYSTEM | MIDI_TYPE_SYSEX));
+        if(channel_voice && (channel < 1 || channel > 16)) return 0;
+        const uint16_t channel_bit = channel_voice ? 1 << (channel - 1) : 1;
+        while(true) {
+            const uint32_t g = generation.load(std::memory_order_acquire);
+            const auto& row = current.load(std::memory_order_acquire)->accept[static_cast<uint8_t>(from)][t];
+            uint8_t out = 0;
+            for(uint8_t to = 0; to < MIDI_PORTS; to++) {
+                if(row[to] & channel_bit) out |= 1 << to;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(generation.load(std::memory_order_relaxed) == g) return out;
+        }
+    }
+};
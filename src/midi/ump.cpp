@@ -0,0 +1,77 @@
+#include "ump.hpp"
+
+// midi 2.0 channel voice messages are message type 4
+constexpr uint8_t MT_MIDI2_VOICE = 0x4;
+
+// whether the op is a note message (16 bit velocity + attribute instead of a 32 bit value),
+// and whether it's defined at all
+struct OpLayout {
+    bool valid;
+    bool note;
+};
+
+static constexpr OpLayout op_layouts[16] = {
+    { true, false }, // registered per note controller
+    { true, false }, // assignable per note controller
+    { true, false }, // registered controller
+    { true, false }, // assignable controller
+    { true, false }, // relative registered controller
+    { true, false }, // relative assignable controller
+    { true, false }, // per note pitch bend
+    { false, false },
+    { true, true }, // note off
+    { true, true }, // note on
+    { true, false }, // poly pressure
+    { true, false }, // control change
+    { true, false }, // program change
+    { true, false }, // channel pressure
+    { true, false }, // pitch bend
+    { true, false } // per note management
+};
+
+const Midi1Mapping ump_midi1_map[16] = {
+    { 0, Midi1Translation::none },
+    { 0, Midi1Translation::none },
+    { 0xB0, Midi1Translation::rpn },
+    { 0xB0, Midi1Translation::nrpn },
+    { 0, Midi1Translation::none }, // relative controllers need the current value, which we don't keep
+    { 0, Midi1Translation::none },
+    { 0, Midi1Translation::none },
+    { 0, Midi1Translation::none },
+    { 0x80, Midi1Translation::note },
+    { 0x90, Midi1Translation::note },
+    { 0xA0, Midi1Translation::data },
+    { 0xB0, Midi1Translation::data },
+    { 0xC0, Midi1Translation::program },
+    { 0xD0, Midi1Translation::value },
+    { 0xE0, Midi1Translation::bend },
+    { 0, Midi1Translation::none }
+};
+
+Ump64 ump_encode(const UmpMessage& message) {
+    const auto op = static_cast<uint8_t>(message.op);
+    const uint32_t word0 = MT_MIDI2_VOICE << 28 | (message.group & 0xF) << 24 | op << 20
+        | (message.channel & 0xF) << 16 | message.index << 8 | message.index2;
+    const uint32_t word1 = op_layouts[op].note ? (message.value & 0xFFFF) << 16 | message.attribute : message.value;
+    return { { word0, word1 } };
+}
+
+bool ump_decode(const uint32_t* words, UmpMessage& out) {
+    if(words[0] >> 28 != MT_MIDI2_VOICE) return false;
+    const uint8_t op = (words[0] >> 20) & 0xF;
+    if(!op_layouts[op].valid) return false;
+
+    out.op = static_cast<UmpOp>(op);
+    out.group = (words[0] >> 24) & 0xF;
+    out.channel = (words[0] >> 16) & 0xF;
+    out.index = (words[0] >> 8) & 0xFF;
+    out.index2 = words[0] & 0xFF;
+    if(op_layouts[op].note) {
+        out.value = words[1] >> 16;
+        out.attribute = words[1] & 0xFFFF;
+    } else {
+        out.value = words[1];
+        out.attribute = 0;
+    }
+    return true;
+}
@@ -0,0 +1,137 @@
+// midi 2.0 universal midi packets. encodes and decodes the 64 bit midi 2.0 channel voice
+// messages (16 bit velocity, note attributes, per note controllers, 32 bit controllers), and
+// translates them down to midi 1.0 for hosts that only speak that. no allocation, the
+// per message differences are all in the tables in ump.cpp
+//
+// only the codec for now, nothing sends ump. the teensy core's usb descriptor has just the midi
+// 1.0 alternate setting, so no host can open a ump endpoint, and sending the translation is the
+// midi 1.0 path with extra steps. what's missing is a midi 2.0 alt setting in the core and
+// picking per host whether it was selected. tools/ump_test.cpp checks the codec on linux
+
+#pragma once
+
+#include <cstdint>
+
+enum class UmpOp : uint8_t {
+    registered_per_note_controller = 0x0, // index: note, index2: controller
+    assignable_per_note_controller = 0x1,
+    registered_controller = 0x2, // index: bank (rpn msb), index2: rpn lsb
+    assignable_controller = 0x3, // nrpn
+    relative_registered_controller = 0x4,
+    relative_assignable_controller = 0x5,
+    per_note_pitch_bend = 0x6, // index: note
+    note_off = 0x8, // index: note, index2: attribute type, value: 16 bit velocity
+    note_on = 0x9,
+    poly_pressure = 0xA, // index: note
+    control_change = 0xB, // index: controller
+    program_change = 0xC, // index2: option flags (bit 0: bank valid), value: program << 24 | bank msb << 8 | bank lsb
+    channel_pressure = 0xD,
+    pitch_bend = 0xE, // value: 0x80000000 is centred
+    per_note_management = 0xF // index: note, index2: option flags
+};
+
+struct UmpMessage {
+    UmpOp op;
+    uint8_t group;
+    uint8_t channel; // 0-15
+    uint8_t index;
+    uint8_t index2;
+    uint32_t value; // 16 bits for notes, 32 for everything else
+    uint16_t attribute; // note on/off attribute data
+};
+
+struct Ump64 {
+    uint32_t words[2];
+};
+
+// words in a packet by message type (top nibble of the first word)
+inline constexpr uint8_t ump_words[16] = { 1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4 };
+
+constexpr uint8_t ump_word_count(const uint32_t word0) {
+    return ump_words[word0 >> 28];
+}
+
+// 8 bit values scaled up by repeating the bits, so 0 stays 0 and 255 becomes 0xFFFF
+constexpr uint16_t ump_velocity(const uint8_t velocity) {
+    return velocity << 8 | velocity;
+}
+
+Ump64 ump_encode(const UmpMessage& message);
+// false if words isn't a midi 2.0 channel voice message
+bool ump_decode(const uint32_t* words, UmpMessage& out);
+
+enum class Midi1Translation : uint8_t {
+    none, // no midi 1.0 equivalent (per note controllers, per note bend, per note management)
+    note, // with the high resolution velocity prefix if the low bits need it
+    data, // index and the top 7 bits of value
+    value, // just the top 7 bits of value
+    bend, // top 14 bits
+    program, // bank select if valid, then the program
+    rpn, // cc 101/100/6/38 with the top 14 bits
+    nrpn // cc 99/98/6/38
+};
+
+struct Midi1Mapping {
+    uint8_t status; // high nibble, the channel gets or'd in
+    Midi1Translation translation;
+};
+
+extern const Midi1Mapping ump_midi1_map[16];
+
+// most midi 1.0 messages one ump can turn into (an rpn)
+#define UMP_MIDI1_MAX 4
+
+// calls put(status, data1, data2) for each midi 1.0 message message translates to, returns how many
+template<typename F>
+uint8_t ump_to_midi1(const UmpMessage& message, F&& put) {
+    const auto m = ump_midi1_map[static_cast<uint8_t>(message.op)];
+    const uint8_t status = m.status | message.channel;
+    const auto cc = [&](const uint8_t control, const uint8_t value) {
+        put(static_cast<uint8_t>(0xB0 | message.channel), control, value);
+    };
+    const auto param = [&](const uint8_t msb_cc, const uint8_t lsb_cc) {
+        const uint16_t v14 = message.value >> 18;
+        cc(msb_cc, message.index);
+        cc(lsb_cc, message.index2);
+        cc(6, v14 >> 7);
+        cc(38, v14 & 0x7F);
+        return 4;
+    };
+
+    switch(m.translation) {
+        case Midi1Translation::note: {
+            const uint16_t v14 = message.value >> 2;
+            uint8_t msb = v14 >> 7;
+            if(message.op == UmpOp::note_on && msb == 0) msb = 1; // velocity 0 would be a note off in midi 1.0
+            // https://www.midi.org/midi/specifications/midi1-specifications/midi-1-addenda/high-resolution-velocity-prefix
+            const bool prefix = (v14 & 0x7F) != 0 && message.op == UmpOp::note_on;
+            if(prefix) cc(0x58, v14 & 0x7F);
+            put(status, message.index, msb);
+            return prefix ? 2 : 1;
+        }
+        case Midi1Translation::data:
+            put(status, message.index, static_cast<uint8_t>(message.value >> 25));
+            return 1;
+        case Midi1Translation::value:
+            put(status, static_cast<uint8_t>(message.value >> 25), 0);
+            return 1;
+        case Midi1Translation::bend: {
+            const uint16_t v14 = message.value >> 18;
+            put(status, v14 & 0x7F, v14 >> 7);
+            return 1;
+        }
+        case Midi1Translation::program:
+            if(message.index2 & 1) {
+                cc(0, (message.value >> 8) & 0x7F);
+                cc(32, message.value & 0x7F);
+            }
+            put(status, (message.value >> 24) & 0x7F, 0);
+            return message.index2 & 1 ? 3 : 1;
+        case Midi1Translation::rpn:
+            return param(101, 100);
+        case Midi1Translation::nrpn:
+            return param(99, 98);
+        default:
+            return 0;
+    }
+}
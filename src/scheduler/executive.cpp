@@ -0,0 +1,92 @@
+#include "executive.hpp"
+
+#ifdef CYCLIC_EXECUTIVE
+
+#include <Arduino.h>
+#include <TeensyThreads.h>
+#include "kscan/kscan_gpio_matrix.hpp"
+#include "kscan/velocity.hpp"
+#include "hardware/midi.hpp"
+#include "hardware/encoder.hpp"
+#include "midi/recorder.hpp"
+
+// slots run back to back in this order at the start of every frame
+constexpr ExecSlot exec_schedule[] = {
+    { "scan", 150, kscan_matrix_poll },
+    { "velocity", 200, velocity_poll },
+    { "recorder", 250, recorder_poll },
+    { "midi", 300, Midi::poll },
+    { "encoder", 900, encoder_poll_next }, // i2c is slow, so only one encoder per frame
+};
+constexpr auto exec_slots_len = sizeof(exec_schedule) / sizeof(exec_schedule[0]);
+
+constexpr bool exec_schedule_valid() {
+    for(size_t i = 0; i < exec_slots_len; i++) {
+        if(exec_schedule[i].deadline_us > EXEC_FRAME_US) return false;
+        if(i > 0 && exec_schedule[i].deadline_us <= exec_schedule[i - 1].deadline_us) return false;
+    }
+    return true;
+}
+static_assert(exec_schedule_valid(), "executive slot deadlines must be strictly increasing and fit in a frame");
+
+static ExecSlotStats slot_stats[exec_slots_len];
+static uint32_t frames = 0;
+static uint32_t late_frames = 0; // frames that started after the previous one should have ended
+static uint32_t skipped_frames = 0;
+static uint32_t max_start_late_us = 0;
+
+[[noreturn]] static void executive_thread() {
+    uint32_t frame_start = micros();
+    while(true) {
+        const uint32_t started = micros();
+        const uint32_t start_late = started - frame_start;
+        if(start_late > max_start_late_us) max_start_late_us = start_late;
+
+        for(size_t i = 0; i < exec_slots_len; i++) {
+            exec_schedule[i].run();
+            const auto end = static_cast<uint16_t>(std::min<uint32_t>(micros() - frame_start, UINT16_MAX));
+            auto& s = slot_stats[i];
+            if(end > s.max_end_us) s.max_end_us = end;
+            if(end > exec_schedule[i].deadline_us) s.overruns++;
+        }
+        frames++;
+
+        frame_start += EXEC_FRAME_US;
+        const auto behind = static_cast<int32_t>(micros() - frame_start);
+        // exactly on time isn't late
+        if(behind > 0) {
+            late_frames++;
+            if(behind >= EXEC_FRAME_US) {
+                // lost at least one whole frame, don't try to catch up with a burst
+                skipped_frames += behind / EXEC_FRAME_US;
+                frame_start += (behind / EXEC_FRAME_US) * EXEC_FRAME_US;
+            }
+            continue;
+        }
+
+        // leftover time goes to the best effort threads
+        while(static_cast<int32_t>(micros() - frame_start) < 0) {
+            Threads::yield();
+        }
+    }
+}
+
+void executive_print_report(const bool reset) {
+    Serial.printf("executive: %lu frames, %lu late, %lu skipped, start up to %lu us late\n",
+        frames, late_frames, skipped_frames, max_start_late_us);
+    for(size_t i = 0; i < exec_slots_len; i++) {
+        Serial.printf("  %-8s deadline %4d us, max end %4d us, %lu overruns\n",
+            exec_schedule[i].name, exec_schedule[i].deadline_us, slot_stats[i].max_end_us, slot_stats[i].overruns);
+    }
+
+    if(reset) {
+        memset(slot_stats, 0, sizeof(slot_stats));
+        frames = late_frames = skipped_frames = max_start_late_us = 0;
+    }
+}
+
+void executive_init() {
+    threads.addThread(executive_thread);
+}
+
+#endif
@@ -0,0 +1,36 @@
+// optional cyclic executive for the musically critical path
+// instead of the timer service, the midi thread and five encoder threads all fighting for
+// round robin slices, one thread runs a fixed table of slots (executive.cpp) every frame:
+// matrix scan, velocity timeouts, midi flush, and one encoder. everything else (ui, sd)
+// only gets the time left over at the end of each frame.
+// the executive gives the leftover time back with Threads::yield() and teensythreads is
+// still round robin, so a frame can start late by one slice of every other thread that's
+// ready (threads x setSliceMicros, a few ms with the ui, event pump, writer and midi threads
+// all busy). that's a bound, not a small one: the slots only run in a fixed order against each
+// other. the report counts slots that finished after their deadline, frames that started late
+// and how late the worst one was, so the real number on a loaded system can be read off it.
+
+#pragma once
+
+#include <cstdint>
+
+//#define CYCLIC_EXECUTIVE
+
+#define EXEC_FRAME_US 1000
+
+struct ExecSlot {
+    const char* name;
+    uint16_t deadline_us; // offset from the start of the frame that the slot has to finish by
+    void (*run)();
+};
+
+struct ExecSlotStats {
+    uint32_t overruns;
+    uint16_t max_end_us;
+};
+
+#ifdef CYCLIC_EXECUTIVE
+void executive_init();
+// dump slot overruns and frame lateness to serial, optionally resetting them after
+void executive_print_report(bool reset);
+#endif
@@ -0,0 +1,217 @@
+// scheduler impl based on threading, not interrupts
+// (so it supports multiple schedulers!) plus maybe won't randomly segfault
+// all the schedulers share the timer service thread, see timer_service.hpp
+
+#pragma once
+
+#include <TeensyThreads.h>
+#include <Arduino.h>
+#include <type_traits>
+#include "timer_service.hpp"
+#include "util/mpsc_queue.hpp"
+
+//#define SCHEDULER_DEBUG
+
+// returned by schedule()/schedule_at() so a job can be cancelled without searching for it.
+// the generation is bumped every time a slot is freed, so a stale handle (job already ran or
+// was cancelled, and the slot got reused by someone else) won't match and can't cancel the new job
+struct JobHandle {
+    uint8_t slot = 0;
+    uint16_t generation = 0; // 0 is never a live generation, so a default handle refers to nothing
+
+    explicit operator bool() const { return generation != 0; }
+};
+
+template<typename TParam, uint8_t Capacity = 32, size_t IsrCapacity = 4>
+class Scheduler : public SchedulerBase {
+private:
+    static constexpr uint8_t NIL = 0xFF;
+    static_assert(Capacity < NIL, "scheduler capacity must fit in a slot index");
+
+    // jobs live in a fixed pool and are linked into a list sorted by run_at, so
+    // inserting doesn't allocate and cancelling is just an unlink
+    struct Job {
+        uint32_t run_at;
+        std::remove_const_t<TParam> param;
+        uint8_t prev, next;
+        uint16_t generation = 1;
+        bool used = false;
+    };
+
+    Job slots[Capacity];
+    uint8_t head = NIL, tail = NIL, free_head = 0;
+    Threads::Mutex jobs_mutex;
+
+    // jobs submitted from interrupts wait here until the timer service thread moves them into slots
+    struct Submission {
+        uint32_t run_at;
+        uint32_t ra_relative_to_ts;
+        std::remove_const_t<TParam> param;
+    };
+    MpscQueue<Submission, IsrCapacity> isr_queue;
+    std::atomic<uint32_t> isr_dropped{0};
+
+    SchedulerStats _stats = {}; // only touched with jobs_mutex held
+    using WorkFunction = void (*)(TParam&);
+    volatile WorkFunction work;
+
+    uint8_t alloc_slot() {
+        const uint8_t i = free_head;
+        if(i == NIL) return NIL;
+        free_head = slots[i].next;
+        slots[i].used = true;
+        return i;
+    }
+
+    void free_slot(const uint8_t i) {
+        auto& s = slots[i];
+        s.used = false;
+        if(++s.generation == 0) s.generation = 1;
+        s.next = free_head;
+        free_head = i;
+    }
+
+    // insert slot i before `before` (NIL = at the end)
+    void link_before(const uint8_t i, const uint8_t before) {
+        auto& s = slots[i];
+        s.next = before;
+        s.prev = before == NIL ? tail : slots[before].prev;
+        if(s.prev == NIL) head = i; else slots[s.prev].next = i;
+        if(before == NIL) tail = i; else slots[before].prev = i;
+    }
+
+    void unlink(const uint8_t i) {
+        const auto& s = slots[i];
+        if(s.prev == NIL) head = s.next; else slots[s.prev].next = s.next;
+        if(s.next == NIL) tail = s.prev; else slots[s.next].prev = s.prev;
+    }
+
+    JobHandle insert_locked(const uint32_t run_at, const uint32_t ra_relative_to_ts, const TParam& param) {
+        const uint8_t i = alloc_slot();
+        if(i == NIL) {
+            Serial.printf("ERR: scheduler full (%d jobs), dropping job\n", Capacity);
+            return {};
+        }
+        slots[i].run_at = run_at;
+        slots[i].param = param;
+
+        uint8_t it = head;
+
+        if(run_at < ra_relative_to_ts && it != NIL) {
+            // we looped over, so increase iterator until the run_at is less than the previous item
+            uint32_t prev = slots[it].run_at;
+            while(it != NIL && slots[it].run_at >= prev) {
+                prev = slots[it].run_at;
+                it = slots[it].next;
+            }
+        }
+
+        while(it != NIL && slots[it].run_at < run_at) {
+            it = slots[it].next;
+        }
+        link_before(i, it);
+        _stats.record_insert();
+
+        return { i, slots[i].generation };
+    }
+
+public:
+    Scheduler(const char* name, const uint8_t priority, WorkFunction work) : SchedulerBase(name, priority), work(work) {
+        for(uint8_t i = 0; i < Capacity; i++) {
+            slots[i].next = i + 1 < Capacity ? i + 1 : NIL;
+        }
+    }
+
+    JobHandle schedule(uint32_t delay_us, TParam param) {
+        auto c = micros();
+        uint32_t run_at = c + delay_us;
+        return schedule_at(run_at, c, param);
+    }
+
+    JobHandle schedule_at(uint32_t run_at, uint32_t ra_relative_to_ts, TParam param) {
+#ifdef SCHEDULER_DEBUG
+        Serial.printf("schedule_at: %d, %d\n", run_at, ra_relative_to_ts);
+#endif
+        Threads::Scope m(jobs_mutex);
+        return insert_locked(run_at, ra_relative_to_ts, param);
+    }
+
+    // lock-free version of schedule_at for interrupt handlers. the job is picked up the next
+    // time the timer service polls this scheduler, and there's no handle so it can't be cancelled.
+    // returns false if the submission queue is full
+    bool schedule_at_from_isr(uint32_t run_at, uint32_t ra_relative_to_ts, TParam param) {
+        if(isr_queue.push({ run_at, ra_relative_to_ts, param })) return true;
+        isr_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // returns false if the job already ran or was cancelled
+    bool cancel(const JobHandle handle) {
+        if(!handle || handle.slot >= Capacity) return false;
+
+        Threads::Scope m(jobs_mutex);
+        auto& s = slots[handle.slot];
+        if(!s.used || s.generation != handle.generation) {
+            _stats.record_cancel(false);
+            return false;
+        }
+
+        unlink(handle.slot);
+        free_slot(handle.slot);
+        _stats.record_cancel(true);
+        return true;
+    }
+
+    [[nodiscard]] SchedulerStats stats() override {
+        Threads::Scope m(jobs_mutex);
+        auto s = _stats;
+        s.isr_dropped = isr_dropped.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void reset_stats() override {
+        Threads::Scope m(jobs_mutex);
+        _stats.reset(millis());
+        isr_dropped.store(0, std::memory_order_relaxed);
+    }
+
+protected:
+    bool run_due() override {
+        jobs_mutex.lock();
+        Submission sub;
+        while(isr_queue.pop(sub)) {
+            insert_locked(sub.run_at, sub.ra_relative_to_ts, sub.param);
+        }
+
+        const uint32_t now = micros();
+#ifdef SCHEDULER_DEBUG
+        if(head != NIL) {
+            Serial.printf("scheduler run_due: front run_at: %d (currently %d)\n", slots[head].run_at, now);
+        }
+#endif
+        if(head == NIL || ((int64_t) slots[head].run_at) - ((int64_t) now) > 0) {
+            jobs_mutex.unlock();
+            return false;
+        }
+#ifdef SCHEDULER_DEBUG
+        Serial.printf("scheduler work\n");
+#endif
+        const uint8_t i = head;
+        auto param = slots[i].param;
+#ifdef SCHEDULER_DEBUG
+        Serial.printf("%d\n", param);
+#endif
+        _stats.record_run(now - slots[i].run_at);
+        unlink(i);
+        free_slot(i);
+        jobs_mutex.unlock();
+        work(param);
+        return true;
+    }
+
+public:
+    // registers with the timer service, which has to be started separately (timer_service.init())
+    void init() {
+        timer_service.add_client(this);
+    }
+};
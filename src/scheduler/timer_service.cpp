@@ -0,0 +1,74 @@
+#include "timer_service.hpp"
+#include <Arduino.h>
+
+void TimerService::add_client(SchedulerBase* client) {
+    Threads::Scope m(clients_mutex);
+    SchedulerBase** it = &clients;
+    while(*it != nullptr && (*it)->priority >= client->priority) {
+        it = &(*it)->next_client;
+    }
+    client->next_client = *it;
+    *it = client;
+}
+
+[[noreturn]] void TimerService::thread_fn() {
+    while(true) {
+        bool ran = false;
+        // start over from the top after every job, so a due job from a higher priority
+        // client never waits behind a burst from a lower priority one
+        for(auto c = clients; c != nullptr; c = c->next_client) {
+            if(c->run_due()) {
+                ran = true;
+                jobs_run++;
+                break;
+            }
+        }
+
+        if(!ran) {
+            yields++;
+            Threads::yield(); // nothing is due, let everyone else run
+        }
+    }
+}
+
+void SchedulerStats::print(const char* name, const uint32_t now_ms) const {
+    const uint32_t elapsed_ms = now_ms - reset_at_ms;
+    Serial.printf("scheduler %s: %lu jobs (%.1f/s), depth %d (max %d), %lu/%lu cancels hit, max late %lu us\n",
+        name, jobs_run, elapsed_ms == 0 ? 0.0 : jobs_run * 1000.0 / elapsed_ms, depth, max_depth,
+        cancel_hits, cancels, max_lateness_us);
+    if(isr_dropped != 0) {
+        Serial.printf("  %lu isr submissions dropped\n", isr_dropped);
+    }
+    Serial.printf("  lateness (us):");
+    for(uint8_t i = 0; i < SCHEDULER_LATENESS_BUCKETS; i++) {
+        if(lateness[i] == 0) continue;
+        Serial.printf(" <%lu:%lu", 1ul << i, lateness[i]);
+    }
+    Serial.printf("\n");
+}
+
+void TimerService::print_stats(const bool reset) {
+    Threads::Scope m(clients_mutex);
+    const auto s = stats();
+    uint8_t schedulers = 0;
+    for(auto c = clients; c != nullptr; c = c->next_client) schedulers++;
+    Serial.printf("timer service: %lu jobs, %lu idle yields, %d schedulers on one thread\n", s.jobs_run, s.yields, schedulers);
+    if(thread_id >= 0 && schedulers > 1) {
+        // what a thread per scheduler (the old SchedulerThread) would cost on top of this one
+        const int used = threads.getStackUsed(thread_id);
+        const int stack = used + threads.getStackRemaining(thread_id);
+        Serial.printf("  stack %d of %d B used, saves %d B of stacks and %d round robin slots that would each spin on yield() while idle\n",
+            used, stack, (schedulers - 1) * stack, schedulers - 1);
+    }
+    if(reset) reset_stats();
+
+    const auto now = millis();
+    for(auto c = clients; c != nullptr; c = c->next_client) {
+        c->stats().print(c->name, now);
+        if(reset) c->reset_stats();
+    }
+}
+
+void TimerService::init() {
+    thread_init();
+}
@@ -0,0 +1,114 @@
+// one thread that runs the jobs of every Scheduler, so each subsystem that needs
+// delayed work doesn't cost another thread + 8 KB stack + a round robin slot
+
+#pragma once
+
+#include <cstdint>
+#include <TeensyThreads.h>
+#include "util/thread.hpp"
+
+class TimerService;
+
+#define SCHEDULER_LATENESS_BUCKETS 16
+
+struct SchedulerStats {
+    // bucket 0 counts jobs that ran exactly on time, bucket i (i > 0) jobs that ran
+    // [2^(i-1), 2^i) us late, and the last bucket everything later than that
+    uint32_t lateness[SCHEDULER_LATENESS_BUCKETS];
+    uint32_t max_lateness_us;
+    uint32_t jobs_run;
+    uint32_t cancels;
+    uint32_t cancel_hits; // cancels that actually removed a job (vs it already having run)
+    uint32_t isr_dropped; // schedule_at_from_isr calls that found the submission queue full
+    uint8_t depth;
+    uint8_t max_depth;
+    uint32_t reset_at_ms; // for jobs per second
+
+    void record_run(const uint32_t lateness_us) {
+        const uint8_t bucket = lateness_us == 0 ? 0 : 32 - __builtin_clz(lateness_us);
+        lateness[bucket < SCHEDULER_LATENESS_BUCKETS ? bucket : SCHEDULER_LATENESS_BUCKETS - 1]++;
+        if(lateness_us > max_lateness_us) max_lateness_us = lateness_us;
+        jobs_run++;
+        depth--;
+    }
+
+    void record_insert() {
+        if(++depth > max_depth) max_depth = depth;
+    }
+
+    void record_cancel(const bool hit) {
+        cancels++;
+        if(hit) {
+            cancel_hits++;
+            depth--;
+        }
+    }
+
+    // keeps the current depth since those jobs are still queued
+    void reset(const uint32_t now_ms) {
+        const uint8_t d = depth;
+        *this = {};
+        depth = max_depth = d;
+        reset_at_ms = now_ms;
+    }
+
+    void print(const char* name, uint32_t now_ms) const;
+};
+
+// a typed job queue that the timer service polls (see scheduler.hpp)
+class SchedulerBase {
+private:
+    SchedulerBase* next_client = nullptr;
+    const uint8_t priority;
+    const char* name;
+    friend class TimerService;
+
+protected:
+    SchedulerBase(const char* name, const uint8_t priority) : priority(priority), name(name) {}
+
+    // run the front job if it is due, returns whether a job was run
+    virtual bool run_due() = 0;
+
+public:
+    // run every job that's due right now, for running a scheduler without the timer service thread
+    uint8_t run_all_due() {
+        uint8_t n = 0;
+        while(run_due()) n++;
+        return n;
+    }
+
+    [[nodiscard]] virtual SchedulerStats stats() = 0;
+    virtual void reset_stats() = 0;
+};
+
+struct TimerServiceStats {
+    uint32_t jobs_run;
+    uint32_t yields; // passes where nothing was due, each one gives up the rest of our slice
+};
+
+class TimerService : public Thread<TimerService> {
+private:
+    // sorted by priority, highest first
+    SchedulerBase* clients = nullptr;
+    Threads::Mutex clients_mutex;
+
+    volatile uint32_t jobs_run = 0;
+    volatile uint32_t yields = 0;
+
+    [[noreturn]] void thread_fn();
+    friend class Thread<TimerService>;
+
+public:
+    // clients with a higher priority always get their due jobs run first
+    void add_client(SchedulerBase* client);
+
+    [[nodiscard]] TimerServiceStats stats() const { return { jobs_run, yields }; }
+    void reset_stats() { jobs_run = 0; yields = 0; }
+
+    // dump the stats of the service and every client to serial, optionally resetting them after
+    void print_stats(bool reset);
+
+    void init();
+};
+
+inline TimerService timer_service;
@@ -0,0 +1,195 @@
+#include "synth.hpp"
+
+#include <Arduino.h>
+#include <algorithm>
+#include <AudioStream.h>
+#include <atomic>
+#include <TeensyThreads.h>
+#include "dsp/dsp.hpp"
+#include "input/input_stream.hpp"
+#include "midi/note_map.hpp"
+#include "util/spsc_queue.hpp"
+
+struct SynthEvent {
+    uint8_t note;
+    uint8_t velocity; // 0 for note off
+};
+
+// event pump -> audio interrupt
+static SpscQueue<SynthEvent, SYNTH_EVENT_QUEUE_LEN> events;
+static NoteMapping sounding[NOTE_KEYS_LEN]; // event pump only
+
+static SynthCore<SYNTH_VOICES> core;
+
+static SynthParams params_buf[2];
+static uint8_t params_write = 0;
+static std::atomic<const SynthParams*> params_next{nullptr};
+static Threads::Mutex params_lock; // writers only
+
+static uint32_t budget_cycles() {
+    return static_cast<uint64_t>(F_CPU_ACTUAL) * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT * SYNTH_CPU_BUDGET_PCT / 100;
+}
+
+// written by the audio interrupt, read anywhere
+static struct {
+    uint32_t blocks;
+    uint32_t overruns; // blocks that went over budget_cycles
+    uint32_t max_cycles;
+    uint32_t voice_blocks; // voices rendered, summed over blocks
+    uint64_t render_cycles;
+    uint32_t dropped; // events that didn't fit in the queue
+    uint32_t no_memory; // blocks skipped because the audio library had no memory
+} stats;
+
+// what render costs with no voices and what each voice adds, from synth_init's calibration and
+// then followed block by block. audio interrupt only once costs_ready is set
+struct RenderCost {
+    uint32_t calibrated;
+    uint32_t estimate;
+
+    // up quickly when a block costs more, back down slowly, and never far from the calibration,
+    // so one block that got interrupted can't take the budget with it
+    void update(const uint32_t sample) {
+        const uint32_t lo = calibrated / SYNTH_COST_BOUND;
+        const uint32_t hi = calibrated * SYNTH_COST_BOUND;
+        if(sample > estimate) estimate += (sample - estimate) >> SYNTH_COST_RISE_SHIFT;
+        else estimate -= (estimate - sample) >> SYNTH_COST_FALL_SHIFT;
+        estimate = std::min(std::max(estimate, lo), hi);
+    }
+};
+static RenderCost fixed_cost;
+static RenderCost voice_cost;
+static std::atomic<bool> costs_ready{false}; // the usb output can start the audio interrupt before synth_init
+
+static void update_budget() {
+    const uint32_t budget = budget_cycles();
+    const uint32_t for_voices = budget > fixed_cost.estimate ? budget - fixed_cost.estimate : 0;
+    core.set_budget(for_voices / std::max<uint32_t>(voice_cost.estimate, 1));
+}
+
+class SynthOutput : public AudioStream {
+public:
+    SynthOutput() : AudioStream(0, nullptr) {}
+
+    void update() override {
+        if(const auto p = params_next.exchange(nullptr, std::memory_order_acquire)) {
+            core.configure(AUDIO_SAMPLE_RATE_EXACT, *p);
+        }
+        SynthEvent e;
+        while(events.pop(e)) {
+            if(e.velocity > 0) core.note_on(e.note, e.velocity);
+            else core.note_off(e.note);
+        }
+
+        float buf[AUDIO_BLOCK_SAMPLES];
+        const uint32_t start = ARM_DWT_CYCCNT;
+        const uint8_t voices = core.render(buf, AUDIO_BLOCK_SAMPLES);
+        const uint32_t cycles = ARM_DWT_CYCCNT - start;
+
+        // a voice costs the same every block, what's left after the fixed part is split between them
+        if(costs_ready.load(std::memory_order_acquire)) {
+            if(voices == 0) {
+                fixed_cost.update(cycles);
+            } else {
+                voice_cost.update(cycles > fixed_cost.estimate ? (cycles - fixed_cost.estimate) / voices : 0);
+            }
+            update_budget();
+        }
+        stats.blocks++;
+        stats.voice_blocks += voices;
+        stats.render_cycles += cycles;
+        if(cycles > stats.max_cycles) stats.max_cycles = cycles;
+        if(cycles > budget_cycles()) stats.overruns++;
+
+        audio_block_t* block = allocate();
+        if(block == nullptr) {
+            stats.no_memory++;
+            return;
+        }
+        dsp_float_to_q15(block->data, buf, AUDIO_BLOCK_SAMPLES);
+        // mono, the same block to both channels
+        transmit(block, 0);
+        transmit(block, 1);
+        release(block);
+    }
+};
+
+static SynthOutput synth_out;
+static AudioOutputUSB usb_out;
+static AudioConnection left(synth_out, 0, usb_out, 0);
+static AudioConnection right(synth_out, 0, usb_out, 1);
+
+static void push(const uint8_t note, const uint8_t velocity) {
+    if(!events.push({ note, velocity })) stats.dropped++;
+}
+
+void synth_configure(const SynthParams& params) {
+    Threads::Scope m(params_lock);
+    params_buf[params_write] = params;
+    params_next.store(&params_buf[params_write], std::memory_order_release);
+    params_write ^= 1;
+}
+
+// times a scratch core with no voices and then all of them. the cheapest of a few runs, anything
+// that interrupts us only adds to it
+static void calibrate() {
+    SynthCore<SYNTH_VOICES> scratch;
+    scratch.configure(AUDIO_SAMPLE_RATE_EXACT, {});
+    float buf[AUDIO_BLOCK_SAMPLES];
+    const auto time = [&] {
+        uint32_t best = UINT32_MAX;
+        for(uint8_t i = 0; i < SYNTH_CALIBRATE_RUNS; i++) {
+            const uint32_t start = ARM_DWT_CYCCNT;
+            scratch.render(buf, AUDIO_BLOCK_SAMPLES);
+            best = std::min(best, ARM_DWT_CYCCNT - start);
+        }
+        return best;
+    };
+    const uint32_t fixed = time();
+    for(uint8_t i = 0; i < SYNTH_VOICES; i++) scratch.note_on(36 + i * 3, 255);
+    const uint32_t all = time();
+    fixed_cost = { std::max<uint32_t>(fixed, 1), std::max<uint32_t>(fixed, 1) };
+    const uint32_t per_voice = std::max<uint32_t>((all > fixed ? all - fixed : 0) / SYNTH_VOICES, 1);
+    voice_cost = { per_voice, per_voice };
+}
+
+void synth_init() {
+    calibrate();
+    costs_ready.store(true, std::memory_order_release);
+    AudioMemory(SYNTH_AUDIO_BLOCKS);
+    for(auto& s : sounding) s.note = NOTE_UNMAPPED;
+    synth_configure({});
+
+    input_stream.add_listener([](const InputBatch& batch) {
+        for(uint8_t i = 0; i < batch.len; i++) {
+            const auto& r = batch.records[i];
+            if(r.type != InputType::note_on && r.type != InputType::note_off) continue;
+            if(r.source >= NOTE_KEYS_LEN) continue;
+            if(r.type == InputType::note_on) {
+                const auto m = note_map_lookup(r.source);
+                if(m.note == NOTE_UNMAPPED) continue;
+                // the same key can't be on twice, but the map can change while it's held
+                sounding[r.source] = m;
+                push(m.note, std::max<uint8_t>(r.value, 1));
+            } else if(sounding[r.source].note != NOTE_UNMAPPED) {
+                push(sounding[r.source].note, 0);
+                sounding[r.source].note = NOTE_UNMAPPED;
+            }
+        }
+    });
+}
+
+void synth_print_stats(const bool reset) {
+    const auto s = stats;
+    const double cycles_per_ms = F_CPU_ACTUAL / 1000.0;
+    Serial.printf("synth: %lu blocks, %d/%d voices active (budget %d), %lu stolen, %lu events dropped, %lu no memory\n",
+        s.blocks, core.active_voices(), SYNTH_VOICES, core.voice_budget(), core.stolen, s.dropped, s.no_memory);
+    Serial.printf("  render: max %lu cycles (budget %lu), %lu overruns, %.1f voice blocks per ms\n",
+        s.max_cycles, budget_cycles(), s.overruns, s.render_cycles == 0 ? 0.0 : s.voice_blocks / (s.render_cycles / cycles_per_ms));
+    Serial.printf("  cost: %lu cycles fixed + %lu per voice (calibrated %lu + %lu)\n",
+        fixed_cost.estimate, voice_cost.estimate, fixed_cost.calibrated, voice_cost.calibrated);
+    if(reset) {
+        stats = {};
+        core.stolen = 0;
+    }
+}
@@ -0,0 +1,24 @@
+// plays the keys through SynthCore into the usb audio output (the build is already
+// USB_MIDI_AUDIO_SERIAL). notes come from input_stream through the note map, like the midi
+// does, and are handed to the audio interrupt through a queue. render's fixed cost and cost per
+// voice are calibrated at startup and then followed from each block's cycles, and the voice
+// budget is set from them so a block stays under SYNTH_CPU_BUDGET_PCT
+
+#pragma once
+
+#include <cstdint>
+#include "synth/synth_core.hpp"
+
+#define SYNTH_EVENT_QUEUE_LEN 64
+#define SYNTH_CPU_BUDGET_PCT 40 // of a block's time (128 samples, 2.9 ms)
+#define SYNTH_AUDIO_BLOCKS 8 // AudioMemory
+#define SYNTH_CALIBRATE_RUNS 8 // renders timed at startup, for each of no voices and every voice
+#define SYNTH_COST_RISE_SHIFT 2 // a block that costs more moves the estimate a quarter of the way up
+#define SYNTH_COST_FALL_SHIFT 6 // and one that costs less, a 64th of the way down
+#define SYNTH_COST_BOUND 4 // the estimates stay within this factor of the calibration
+
+// allocates audio memory and adds the input_stream listener, so call before event_pump.init()
+void synth_init();
+// any thread
+void synth_configure(const SynthParams& params);
+void synth_print_stats(bool reset);
@@ -0,0 +1,246 @@
+// the synth's render core: a fixed pool of voices (polyblep saw -> one pole lowpass -> envelope),
+// float all the way through. every active voice costs the same per sample whatever it's doing
+// (envelope stages only change between blocks), so a block costs voices * a constant, and
+// capping the voices caps the block. nothing teensy specific in here, tools/synth_render.cpp
+// runs it on linux
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#define SYNTH_VOICES 16
+#define SYNTH_ENV_FLOOR 0.0001f // a releasing voice below this is done
+#define SYNTH_FADE_S 0.001f // time constant of a voice cut for the budget, gone in about 10 ms
+
+struct SynthParams {
+    float attack_s = 0.005f;
+    float decay_s = 0.3f; // time constant towards sustain
+    float sustain = 0.6f;
+    float release_s = 0.25f; // time constant towards 0
+    float cutoff_hz = 4000.0f; // at full velocity, down to a quarter of this at 0
+    float gain = 0.2f; // per voice at full velocity
+};
+
+template<uint8_t Voices = SYNTH_VOICES>
+class SynthCore {
+private:
+    enum class Stage : uint8_t {
+        idle,
+        attack,
+        decay, // and sustain, it just stays here once it gets there
+        release,
+        fade // over the budget, a fast release so it doesn't click. doesn't count against the budget
+    };
+
+    struct Voice {
+        Stage stage;
+        uint8_t note;
+        uint32_t started; // note_on count when it started, oldest gets stolen first
+        float phase; // 0-1
+        float inc; // phase per sample
+        float amp;
+        float lp; // filter state
+        float lp_coef;
+        float env;
+        float env_target;
+        float env_coef;
+    };
+
+    Voice voices[Voices] = {};
+    float note_inc[128] = {};
+    float sample_rate = 44100.0f;
+    SynthParams params;
+    float attack_coef = 0;
+    float decay_coef = 0;
+    float release_coef = 0;
+    float fade_coef = 0;
+    uint8_t budget = Voices;
+    uint32_t note_ons = 0;
+
+    // attack heads for 1.5 so it reaches 1 in attack_s instead of creeping up on it
+    static constexpr float ATTACK_TARGET = 1.5f;
+
+    static float polyblep(float t, const float dt) {
+        if(t < dt) {
+            t /= dt;
+            return t + t - t * t - 1.0f;
+        }
+        if(t > 1.0f - dt) {
+            t = (t - 1.0f) / dt;
+            return t * t + t + t + 1.0f;
+        }
+        return 0.0f;
+    }
+
+    void set_stage(Voice& v, const Stage stage) {
+        v.stage = stage;
+        switch(stage) {
+            case Stage::attack:
+                v.env_target = ATTACK_TARGET;
+                v.env_coef = attack_coef;
+                break;
+            case Stage::decay:
+                v.env_target = params.sustain;
+                v.env_coef = decay_coef;
+                break;
+            case Stage::release:
+                v.env_target = 0;
+                v.env_coef = release_coef;
+                break;
+            case Stage::fade:
+                v.env_target = 0;
+                v.env_coef = fade_coef;
+                break;
+            case Stage::idle:
+                v.env = 0;
+                break;
+        }
+    }
+
+    // a free voice if we're under budget, else whichever is quietest on its way out, else the oldest
+    Voice& allocate() {
+        Voice* free = nullptr;
+        Voice* releasing = nullptr;
+        Voice* oldest = nullptr;
+        uint8_t active = 0;
+        for(auto& v : voices) {
+            if(v.stage == Stage::idle) {
+                if(free == nullptr) free = &v;
+                continue;
+            }
+            if(v.stage != Stage::fade) active++;
+            const bool ending = v.stage == Stage::release || v.stage == Stage::fade;
+            if(ending && (releasing == nullptr || v.env < releasing->env)) releasing = &v;
+            if(oldest == nullptr || v.started - oldest->started > UINT32_MAX / 2) oldest = &v;
+        }
+        if(free != nullptr && active < budget) return *free;
+        stolen++;
+        return releasing != nullptr ? *releasing : *oldest;
+    }
+
+    void render_voice(Voice& v, float* out, const uint16_t len) const {
+        float phase = v.phase;
+        float lp = v.lp;
+        float env = v.env;
+        const float inc = v.inc;
+        const float lp_coef = v.lp_coef;
+        const float env_target = v.env_target;
+        const float env_coef = v.env_coef;
+        const float amp = v.amp;
+        for(uint16_t i = 0; i < len; i++) {
+            phase += inc;
+            if(phase >= 1.0f) phase -= 1.0f;
+            const float saw = 2.0f * phase - 1.0f - polyblep(phase, inc);
+            lp += lp_coef * (saw - lp);
+            env = env_target + (env - env_target) * env_coef;
+            out[i] += lp * std::fmin(env, 1.0f) * amp;
+        }
+        v.phase = phase;
+        v.lp = lp;
+        v.env = env;
+    }
+
+public:
+    uint32_t stolen = 0; // voices taken for a new note or faded out for a smaller budget
+
+    void configure(const float rate, const SynthParams& p) {
+        sample_rate = rate;
+        params = p;
+        for(uint8_t n = 0; n < 128; n++) {
+            note_inc[n] = 440.0f * std::pow(2.0f, (n - 69) / 12.0f) / rate;
+        }
+        attack_coef = std::exp(std::log(1.0f - 1.0f / ATTACK_TARGET) / std::fmax(p.attack_s * rate, 1.0f));
+        decay_coef = std::exp(-1.0f / std::fmax(p.decay_s * rate, 1.0f));
+        release_coef = std::exp(-1.0f / std::fmax(p.release_s * rate, 1.0f));
+        fade_coef = std::exp(-1.0f / std::fmax(SYNTH_FADE_S * rate, 1.0f));
+        // voices already playing pick up the new times at their next stage
+    }
+
+    // velocity is the velocity module's 0-255
+    void note_on(const uint8_t note, const uint8_t velocity) {
+        if(note > 127) return;
+        Voice* voice = nullptr;
+        // the same note again takes over its own voice instead of stacking
+        for(auto& v : voices) {
+            if(v.stage != Stage::idle && v.note == note) voice = &v;
+        }
+        Voice& v = voice != nullptr ? *voice : allocate();
+        const float vel = velocity / 255.0f;
+        if(v.stage == Stage::idle) {
+            v.phase = 0;
+            v.lp = 0;
+        }
+        // env carries on from where a stolen or retriggered voice was, so there's no click
+        v.note = note;
+        v.started = note_ons++;
+        v.inc = note_inc[note];
+        v.amp = params.gain * vel * vel;
+        const float cutoff = params.cutoff_hz * (0.25f + 0.75f * vel);
+        v.lp_coef = 1.0f - std::exp(-2.0f * static_cast<float>(M_PI) * cutoff / sample_rate);
+        set_stage(v, Stage::attack);
+    }
+
+    void note_off(const uint8_t note) {
+        for(auto& v : voices) {
+            if(v.note == note && (v.stage == Stage::attack || v.stage == Stage::decay)) set_stage(v, Stage::release);
+        }
+    }
+
+    void all_off() {
+        for(auto& v : voices) {
+            if(v.stage != Stage::idle && v.stage != Stage::fade) set_stage(v, Stage::release);
+        }
+    }
+
+    // at most this many voices play, the oldest extra ones fade out from the next render. the
+    // fading ones still render for the few blocks that takes
+    void set_budget(const uint8_t voices_max) {
+        budget = voices_max < 1 ? 1 : voices_max > Voices ? Voices : voices_max;
+    }
+    [[nodiscard]] uint8_t voice_budget() const { return budget; }
+
+    // overwrites out with len samples (mono), returns how many voices were rendered
+    uint8_t render(float* out, const uint16_t len) {
+        for(uint16_t i = 0; i < len; i++) out[i] = 0;
+
+        uint8_t active = 0;
+        uint8_t playing = 0; // the ones the budget is for
+        for(auto& v : voices) {
+            if(v.stage == Stage::idle) continue;
+            active++;
+            if(v.stage != Stage::fade) playing++;
+        }
+        while(playing > budget) {
+            Voice* oldest = nullptr;
+            for(auto& v : voices) {
+                if(v.stage == Stage::idle || v.stage == Stage::fade) continue;
+                if(oldest == nullptr || v.started - oldest->started > UINT32_MAX / 2) oldest = &v;
+            }
+            set_stage(*oldest, Stage::fade);
+            stolen++;
+            playing--;
+        }
+
+        for(auto& v : voices) {
+            if(v.stage == Stage::idle) continue;
+            render_voice(v, out, len);
+            // stage changes only here, so the loop above is the same work for every voice
+            if(v.stage == Stage::attack && v.env >= 1.0f) {
+                v.env = 1.0f;
+                set_stage(v, Stage::decay);
+            } else if((v.stage == Stage::release || v.stage == Stage::fade) && v.env < SYNTH_ENV_FLOOR) {
+                set_stage(v, Stage::idle);
+            }
+        }
+        return active;
+    }
+
+    [[nodiscard]] uint8_t active_voices() const {
+        uint8_t n = 0;
+        for(const auto& v : voices) {
+            if(v.stage != Stage::idle) n++;
+        }
+        return n;
+    }
+};
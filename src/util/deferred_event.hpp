@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+#include <TeensyThreads.h>
+#include "event.hpp"
+#include "mpsc_queue.hpp"
+#include "thread.hpp"
+
+// deferred events: emit() only copies the message into a lock-free queue, and the listeners
+// run later on the event pump thread. for producers that can't afford to wait on a slow
+// listener (the kscan path, encoder polling, interrupts)
+
+enum class OverflowPolicy : uint8_t {
+    drop_newest, // the message that didn't fit is dropped (the only one that's safe from an interrupt)
+    block // the producer yields until there's room
+};
+
+class EventPump;
+
+class DeferredEventBase {
+private:
+    DeferredEventBase* next_event = nullptr;
+    friend class EventPump;
+
+protected:
+    std::atomic<uint32_t> overflows{0};
+
+    // run the listeners for everything that's queued, returns how many messages were delivered
+    virtual uint8_t deliver() = 0;
+
+public:
+    // drop_newest: messages dropped, block: times the producer had to wait
+    [[nodiscard]] uint32_t overflow_count() const { return overflows.load(std::memory_order_relaxed); }
+    void reset_overflow_count() { overflows.store(0, std::memory_order_relaxed); }
+};
+
+template<typename TEvent, typename TMessage, size_t QueueCapacity, OverflowPolicy Policy>
+class Deferred : public TEvent, public DeferredEventBase {
+private:
+    MpscQueue<std::remove_const_t<TMessage>, QueueCapacity> queue;
+
+protected:
+    uint8_t deliver() override {
+        uint8_t n = 0;
+        std::remove_const_t<TMessage> message;
+        // bounded so one busy event can't starve the others on the pump
+        while(n < QueueCapacity && queue.pop(message)) {
+            TEvent::emit(message);
+            n++;
+        }
+        return n;
+    }
+
+public:
+    // returns false if the message was dropped
+    bool emit(const TMessage& message) {
+        if(queue.push(message)) return true;
+
+        overflows.fetch_add(1, std::memory_order_relaxed);
+        if constexpr(Policy == OverflowPolicy::block) {
+            while(!queue.push(message)) {
+                Threads::yield();
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+template<typename TMessage, size_t QueueCapacity = 16, OverflowPolicy Policy = OverflowPolicy::drop_newest>
+using DeferredBroadcastEvent = Deferred<BroadcastEvent<TMessage>, TMessage, QueueCapacity, Policy>;
+
+template<typename TMessage, size_t QueueCapacity = 16, OverflowPolicy Policy = OverflowPolicy::drop_newest>
+using DeferredDispatcherEvent = Deferred<DispatcherEvent<TMessage>, TMessage, QueueCapacity, Policy>;
+
+template<typename TMessage, size_t QueueCapacity = 16, OverflowPolicy Policy = OverflowPolicy::drop_newest>
+using DeferredBubblingEvent = Deferred<BubblingEvent<TMessage>, TMessage, QueueCapacity, Policy>;
+
+// the thread that deferred events are delivered on
+class EventPump : public Thread<EventPump> {
+private:
+    DeferredEventBase* events = nullptr;
+
+    [[noreturn]] void thread_fn() {
+        while(true) {
+            if(pump() == 0) {
+                threads.delay(1); // nobody here is latency critical, don't spin
+            }
+        }
+    }
+    friend class Thread<EventPump>;
+
+public:
+    // one pass over every event on the calling thread, returns how many messages were delivered.
+    // the thread loops on this, the host programs in tools/ call it instead
+    uint16_t pump() {
+        uint16_t delivered = 0;
+        for(auto e = events; e != nullptr; e = e->next_event) {
+            delivered += e->deliver();
+        }
+        return delivered;
+    }
+
+    // add every event before calling init()
+    void add(DeferredEventBase* event) {
+        event->next_event = events;
+        events = event;
+    }
+
+    void init() {
+        thread_init();
+    }
+};
+
+inline EventPump event_pump;
@@ -1,60 +1,99 @@
 #pragma once
 
-#include <forward_list>
+#include <cstddef>
+#include <cstdint>
+#include <inplace_function.h>
 
 //#define EVENT_DEBUG
 
-template<typename TMessage, typename TListener>
+// listeners are stored inline (no heap), so lambdas can capture up to this many bytes
+#define EVENT_LISTENER_STORAGE 16
+#define EVENT_LISTENER_CAPACITY 4
+
+// listeners are kept in a fixed size array, newest last. that's the "top of the stack"
+// for the dispatcher and bubbling events, and the first one called for all of them.
+// emit isn't virtual, each event type has its own so the call is resolved at compile time
+template<typename TMessage, typename TResult, size_t Capacity = EVENT_LISTENER_CAPACITY>
 class EventBase {
+public:
+    using Listener = TeensyTimerTool::stdext::inplace_function<TResult(TMessage&), EVENT_LISTENER_STORAGE>;
+    // returned by add_listener so it can be removed again, 0 means it wasn't added
+    using ListenerId = uint8_t;
+
 protected:
-    std::forward_list<TListener> listeners;
+    Listener listeners[Capacity];
+    ListenerId ids[Capacity] = {};
+    uint8_t count = 0;
+    ListenerId next_id = 1;
+
 public:
-    void add_listener(TListener listener) {
+    // returns 0 if there's no room left (increase the capacity for this event)
+    ListenerId add_listener(Listener listener) {
 #ifdef EVENT_DEBUG
         Serial.println("EventBase: adding listener");
 #endif
-        listeners.push_front(listener);
+        if(count == Capacity) return 0;
+
+        const ListenerId id = next_id;
+        if(++next_id == 0) next_id = 1;
+        listeners[count] = std::move(listener);
+        ids[count] = id;
+        count++;
+        return id;
     }
 
-    void remove_listener(TListener listener) {
+    void remove_listener(const ListenerId id) {
 #ifdef EVENT_DEBUG
         Serial.println("EventBase: removing listener");
 #endif
-        listeners.remove(listener);
+        for(uint8_t i = 0; i < count; i++) {
+            if(ids[i] != id) continue;
+
+            // keep the order, the dispatcher and bubbling events depend on it
+            for(uint8_t j = i; j + 1 < count; j++) {
+                listeners[j] = std::move(listeners[j + 1]);
+                ids[j] = ids[j + 1];
+            }
+            count--;
+            listeners[count] = nullptr;
+            ids[count] = 0;
+            return;
+        }
     }
 
-    virtual void emit(TMessage& message) = 0;
+    [[nodiscard]] bool empty() const { return count == 0; }
 };
 
-template<typename TMessage>
-using VoidEventBase = EventBase<TMessage, void (*)(TMessage&)>;
+template<typename TMessage, size_t Capacity = EVENT_LISTENER_CAPACITY>
+using VoidEventBase = EventBase<TMessage, void, Capacity>;
 
-template<typename TMessage>
-class BroadcastEvent : public VoidEventBase<TMessage> {
+template<typename TMessage, size_t Capacity = EVENT_LISTENER_CAPACITY>
+class BroadcastEvent : public VoidEventBase<TMessage, Capacity> {
+    using Base = VoidEventBase<TMessage, Capacity>;
 public:
     void emit(TMessage& message) {
-        if(VoidEventBase<TMessage>::listeners.empty()) return;
+        if(Base::count == 0) return;
 #ifdef EVENT_DEBUG
         Serial.println("BroadcastEvent: emitting");
 #endif
-        for(auto& listener : VoidEventBase<TMessage>::listeners) {
-            listener(message);
+        for(uint8_t i = Base::count; i-- > 0;) {
+            Base::listeners[i](message);
         }
     }
 };
 
 // "dispatcher event" - keep a stack of handlers for some event, and when emitted,
 // just call the handler on the top of the stack
-template<typename TMessage>
-class DispatcherEvent : public VoidEventBase<TMessage> {
+template<typename TMessage, size_t Capacity = EVENT_LISTENER_CAPACITY>
+class DispatcherEvent : public VoidEventBase<TMessage, Capacity> {
+    using Base = VoidEventBase<TMessage, Capacity>;
 public:
     void emit(TMessage& message) {
-        if(!VoidEventBase<TMessage>::listeners.empty()) {
+        if(Base::count != 0) {
 #ifdef EVENT_DEBUG
             Serial.println("DispatcherEvent: there is a listener, calling it");
 #endif
-            auto front = VoidEventBase<TMessage>::listeners.front();
-            front(message);
+            Base::listeners[Base::count - 1](message);
         } else {
 #ifdef EVENT_DEBUG
             Serial.println("DispatcherEvent: no listener");
@@ -66,19 +105,19 @@ public:
 // "bubbling event" - keep a stack of handlers for some event, and when emitted,
 // traverse the listener stack from top to bottom calling the listeners and stop
 // when a listener returns true
-template<typename TMessage>
-using BubblingEventBase = EventBase<TMessage, bool (*)(TMessage&)>;
+template<typename TMessage, size_t Capacity = EVENT_LISTENER_CAPACITY>
+using BubblingEventBase = EventBase<TMessage, bool, Capacity>;
 
-template<typename TMessage>
-class BubblingEvent : public BubblingEventBase<TMessage> {
+template<typename TMessage, size_t Capacity = EVENT_LISTENER_CAPACITY>
+class BubblingEvent : public BubblingEventBase<TMessage, Capacity> {
+    using Base = BubblingEventBase<TMessage, Capacity>;
 public:
     void emit(TMessage& message) {
-        if(BubblingEventBase<TMessage>::listeners.empty()) return;
-        for(auto& listener : BubblingEventBase<TMessage>::listeners) {
+        for(uint8_t i = Base::count; i-- > 0;) {
 #ifdef EVENT_DEBUG
             Serial.println("BubblingEvent: calling listener");
 #endif
-            if(listener(message)) {
+            if(Base::listeners[i](message)) {
 #ifdef EVENT_DEBUG
                 Serial.println("BubblingEvent: listener returned true, stopping");
 #endif
@@ -86,4 +125,4 @@ public:
             }
         }
     }
-};
\ No newline at end of file
+};
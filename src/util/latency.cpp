@@ -0,0 +1,111 @@
+#include "latency.hpp"
+#include <Arduino.h>
+
+#ifdef LATENCY_BENCH
+#include "kscan/kscan_gpio_matrix.hpp"
+#include "spsc_queue.hpp"
+
+enum Stage : uint8_t {
+    edge,
+    kscan,
+    decision,
+    submit,
+    STAGES
+};
+
+struct Sample {
+    uint32_t ts[STAGES];
+};
+
+// edge, kscan and decision all happen on the key path, only the in flight queue crosses over
+// to the sender. it has an entry for every note on in the send queue, in the same order, and the
+// ones we have nothing to measure for (velocity timeouts, Midi::play) are all zeros
+static uint32_t edge_ts[MATRIX_LEN];
+static uint32_t kscan_ts[MATRIX_LEN];
+static Sample decided[MATRIX_LEN / 2];
+static SpscQueue<Sample, LATENCY_IN_FLIGHT_LEN> in_flight;
+
+static LatencyHistogram stages[STAGES]; // [i] is from stage i - 1 to stage i, [0] is the total
+static const char* stage_names[STAGES] = { "total", "edge -> kscan", "kscan -> decision", "decision -> submit" };
+static LatencyHistogram sequenced; // only ever written by the sender
+static uint32_t incomplete = 0; // notes we didn't see every stage of
+static uint32_t overflows = 0;
+
+void latency_raw(const uint8_t matrix_index, const bool active, const uint32_t ts) {
+    if(!active) {
+        // bounced open before the debouncer took it, the next contact starts over
+        edge_ts[matrix_index] = 0;
+    } else if(edge_ts[matrix_index] == 0) {
+        edge_ts[matrix_index] = ts;
+    }
+}
+
+void latency_kscan(const uint8_t matrix_index, const bool pressed, const uint32_t ts) {
+    if(pressed) {
+        kscan_ts[matrix_index] = ts;
+    } else {
+        edge_ts[matrix_index] = 0;
+        kscan_ts[matrix_index] = 0;
+    }
+}
+
+void latency_decision(const uint8_t key, const uint32_t ts) {
+    // the lower switch of a key is on the odd matrix row below it
+    const uint8_t lower = (key / COLS_LEN * 2 + 1) * COLS_LEN + key % COLS_LEN;
+    decided[key] = { { edge_ts[lower], kscan_ts[lower], ts, 0 } };
+    edge_ts[lower] = 0;
+}
+
+void latency_queued(const uint8_t key) {
+    Sample s = {};
+    if(key != LATENCY_NO_KEY) {
+        // nothing decided means it's not from the lower switch (velocity timeout)
+        if(decided[key].ts[decision] != 0) {
+            if(decided[key].ts[edge] == 0 || decided[key].ts[kscan] == 0) incomplete++;
+            else s = decided[key];
+        }
+        decided[key] = {};
+    }
+    if(!in_flight.push(s)) overflows++;
+}
+
+void latency_submit(const uint32_t ts) {
+    Sample s;
+    if(!in_flight.pop(s) || s.ts[decision] == 0) return;
+    s.ts[submit] = ts;
+    for(uint8_t i = kscan; i < STAGES; i++) {
+        stages[i].record(s.ts[i] - s.ts[i - 1]);
+    }
+    stages[0].record(s.ts[submit] - s.ts[edge]);
+}
+
+void latency_sequenced(const uint32_t due, const uint32_t ts) {
+    // early can't happen unless the clock wrapped in between, count it as on time
+    const auto late = static_cast<int32_t>(ts - due);
+    sequenced.record(late < 0 ? 0 : late);
+}
+
+void latency_print_report(const bool reset) {
+    Serial.printf("latency: %lu notes, %lu incomplete, %lu dropped\n", stages[0].count, incomplete, overflows);
+    for(uint8_t i = 0; i < STAGES; i++) {
+        stages[i].print(stage_names[i]);
+    }
+    if(sequenced.count > 0) sequenced.print("sequenced due -> submit");
+    if(reset) {
+        sequenced = {};
+        for(auto& s : stages) s = {};
+        incomplete = 0;
+        overflows = 0;
+    }
+}
+#endif
+
+void LatencyHistogram::print(const char* name) const {
+    Serial.printf("  %s: avg %lu us, max %lu us\n   ", name,
+        count == 0 ? 0ul : static_cast<unsigned long>(total_us / count), max_us);
+    for(uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        if(buckets[i] == 0) continue;
+        Serial.printf(" <%lu:%lu", 1ul << i, buckets[i]);
+    }
+    Serial.printf("\n");
+}
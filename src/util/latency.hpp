@@ -0,0 +1,57 @@
+// key to midi latency measurement. with LATENCY_BENCH defined, every note on played from the
+// lower switch carries timestamps through the pipeline:
+//   edge: the start of the contact the debouncer accepted (the scan's scheduled time, or the
+//         interrupt time for the scan an interrupt started). while the matrix is polled that's
+//         up to a scan period after the switch really closed, which the total doesn't include
+//         (tools/latency_bench.cpp measures it against simulated switches)
+//   kscan: kscan reported the debounced press
+//   decision: the velocity module decided to play the note
+//   submit: the midi sender handed the note on to the usb stack
+// and latency_print_report() prints a histogram for each stage and for the total.
+// sequenced events (the arpeggiator) get a histogram of how late they reached usb.
+// only takes timestamps it's given, so it doesn't care what clock they come from
+
+#pragma once
+
+#include <cstdint>
+
+//#define LATENCY_BENCH
+
+#define LATENCY_BUCKETS 16
+// note ons between being queued and reaching usb, at most the midi queue plus the tx batch
+#define LATENCY_IN_FLIGHT_LEN 256
+#define LATENCY_NO_KEY 0xFF // a note on that isn't from a key (Midi::play)
+
+struct LatencyHistogram {
+    uint32_t buckets[LATENCY_BUCKETS]; // bucket i counts samples < 2^i us
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t max_us;
+
+    void record(const uint32_t us) {
+        const uint8_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+        buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+        count++;
+        total_us += us;
+        if(us > max_us) max_us = us;
+    }
+
+    void print(const char* name) const;
+};
+
+#ifdef LATENCY_BENCH
+// kscan, for every switch read while it isn't debounced as pressed
+void latency_raw(uint8_t matrix_index, bool active, uint32_t ts);
+// kscan, when it reports a debounced change
+void latency_kscan(uint8_t matrix_index, bool pressed, uint32_t ts);
+// velocity, when a lower switch press plays a note. key is row * COLS_LEN + column of the key
+void latency_decision(uint8_t key, uint32_t ts);
+// midi key path, right before any note on goes into the send queue (key or LATENCY_NO_KEY).
+// the sender pairs them up with what it sends in order, so every note on needs one
+void latency_queued(uint8_t key);
+// midi sender, a note on was written to usb
+void latency_submit(uint32_t ts);
+// midi sender, an arpeggiator/sequencer event that was due at due went out to usb at ts
+void latency_sequenced(uint32_t due, uint32_t ts);
+void latency_print_report(bool reset);
+#endif
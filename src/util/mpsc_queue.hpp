@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// bounded lock-free multi producer, single consumer queue (dmitry vyukov's bounded queue,
+// with the consumer side simplified since there's only one)
+// push() never blocks or takes a lock, so it's safe from interrupts. if an interrupt
+// preempts a thread in the middle of a push, the cortex-m7 clears the exclusive monitor
+// on exception entry so the thread's compare-exchange just retries.
+// an interrupted push can make pop() briefly see the queue as empty, which is fine for
+// a consumer that polls anyway
+template<typename T, size_t Capacity>
+class MpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of 2");
+    static constexpr uint32_t mask = Capacity - 1;
+
+    struct Cell {
+        std::atomic<uint32_t> sequence;
+        T data;
+    };
+
+    Cell cells[Capacity];
+    std::atomic<uint32_t> enqueue_pos{0};
+    uint32_t dequeue_pos = 0; // only touched by the consumer
+
+public:
+    MpscQueue() {
+        for(uint32_t i = 0; i < Capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // returns false (and drops the value) if the queue is full
+    bool push(const T& value) {
+        uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while(true) {
+            Cell& cell = cells[pos & mask];
+            const uint32_t seq = cell.sequence.load(std::memory_order_acquire);
+            const auto dif = static_cast<int32_t>(seq - pos);
+            if(dif == 0) {
+                if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+                // pos was updated by the failed compare-exchange, try again
+            } else if(dif < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // only call from the consumer
+    bool pop(T& out) {
+        Cell& cell = cells[dequeue_pos & mask];
+        const uint32_t seq = cell.sequence.load(std::memory_order_acquire);
+        if(static_cast<int32_t>(seq - (dequeue_pos + 1)) < 0) return false;
+
+        out = cell.data;
+        cell.sequence.store(dequeue_pos + Capacity, std::memory_order_release);
+        dequeue_pos++;
+        return true;
+    }
+
+    // approximate when called concurrently with push
+    [[nodiscard]] size_t size() const {
+        return enqueue_pos.load(std::memory_order_relaxed) - dequeue_pos;
+    }
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// bounded lock-free single producer, single consumer ring buffer
+// cheaper than MpscQueue (no compare-exchange), but only one thread or interrupt may push
+template<typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of 2");
+    static constexpr uint32_t mask = Capacity - 1;
+
+    T items[Capacity];
+    std::atomic<uint32_t> head{0}; // next to pop, written by the consumer
+    std::atomic<uint32_t> tail{0}; // next to push, written by the producer
+
+public:
+    // producer only, returns false if the queue is full
+    bool push(const T& value) {
+        const uint32_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == Capacity) return false;
+        items[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only
+    bool pop(T& out) {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) return false;
+        out = items[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only, copies out what pop() would return but leaves it queued
+    bool peek(T& out) const {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) return false;
+        out = items[h & mask];
+        return true;
+    }
+
+    // exact from either side's point of view, approximate from anywhere else
+    [[nodiscard]] size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] static constexpr size_t capacity() { return Capacity; }
+};
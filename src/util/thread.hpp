@@ -5,12 +5,13 @@
 template<class T>
 class Thread {
 private:
+    int thread_id = -1; // teensythreads' id once thread_init has run, for its stack stats
     static void thread_wrapper(void* a) {
         auto pThis = static_cast<T*>(a);
         pThis->thread_fn();
     }
     void thread_init() {
-        threads.addThread(thread_wrapper, this);
+        thread_id = threads.addThread(thread_wrapper, this);
     }
     friend T;
 };
\ No newline at end of file
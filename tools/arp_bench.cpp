@@ -0,0 +1,198 @@
+// the arpeggiator's timer interrupt (src/midi/arp.cpp) into the real midi sender, on a fake
+// clock: held chords at random tempos, gates and modes, with the interrupt going off a little
+// early (the gpt rounds) or late, and the sender getting its turn up to a round robin slice
+// after that. checks the steps and gates that come out of usb against the tempo, that the
+// sender's sequenced histogram (latency_sequenced) saw every event, and then does it again with
+// the interrupt sometimes held off for up to two steps, where the timer has to be re-armed for
+// dues that already went by (never for more than a step, and no note left sounding)
+//
+//   g++ -std=gnu++17 -O2 -Wall -Wextra -Wno-format -DLATENCY_BENCH -Itools/host -Isrc -Itools -Ilib/TeensyTimerTool/src tools/arp_bench.cpp src/hardware/midi.cpp src/input/input_stream.cpp src/midi/note_map.cpp src/midi/mpe.cpp src/midi/midi_clock.cpp -o arp_bench
+//   ./arp_bench [segments]
+//
+// (-Wno-format: the firmware prints uint32_t with %lu, which is right on the teensy)
+
+#include "midi/arp.cpp"
+#include "util/latency.cpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include "host_check.hpp"
+#include "host_usb.hpp"
+
+constexpr uint32_t SLICE_US = 100; // the sender waits for up to one slice to get its turn
+constexpr uint32_t FRAME_US = 125; // high speed start of frame
+constexpr uint32_t ISR_EARLY_US = 2;
+constexpr uint32_t ISR_LATE_US = 3;
+constexpr uint32_t STEPS = 32; // per segment
+
+static std::mt19937 rng(1);
+
+static uint32_t random(const uint32_t lo, const uint32_t hi) {
+    return std::uniform_int_distribution<uint32_t>(lo, hi)(rng);
+}
+
+// what usb saw
+
+static std::vector<uint32_t> on_ts; // note ons this segment
+static uint8_t sounding_note = NOTE_UNMAPPED;
+static uint32_t sounding_ts = 0;
+static uint32_t events = 0; // sequenced note ons and offs
+static uint32_t unpaired = 0; // a note on while one was sounding, or an off for another note
+static LatencyHistogram gates; // how far each note's length was from its gate
+
+static uint32_t gate_us = 0; // the current segment's, for the note offs
+
+static void on_packet(const std::vector<HostUsbEvent>& packet, uint32_t) {
+    for(const auto& e : packet) {
+        const uint8_t cin = e.packet & 0xF;
+        const uint8_t note = e.packet >> 16 & 0x7F;
+        const bool on = cin == 0x9 && (e.packet >> 24) != 0;
+        if(!on && cin != 0x8) continue;
+        events++;
+        if(on) {
+            if(sounding_note != NOTE_UNMAPPED) unpaired++;
+            sounding_note = note;
+            sounding_ts = e.written_us;
+            on_ts.push_back(e.written_us);
+        } else {
+            if(note != sounding_note) unpaired++;
+            gates.record(std::abs(static_cast<int32_t>(e.written_us - sounding_ts - gate_us)));
+            sounding_note = NOTE_UNMAPPED;
+        }
+    }
+}
+
+// the interrupt, the sender and the start of frame, in time order until end
+
+static bool hold_off = false; // sometimes hold the interrupt off for up to two steps
+static uint32_t blackout_us = 0;
+
+static void run_until(const uint32_t end) {
+    static uint32_t seen_triggers = 0;
+    static uint32_t fire_at = 0;
+    static uint32_t sender_at = 0;
+    static uint32_t frame_at = 0;
+    while(before(micros(), end)) {
+        if(timer.armed && timer.triggers != seen_triggers) {
+            seen_triggers = timer.triggers;
+            fire_at = timer.due - ISR_EARLY_US + random(0, ISR_EARLY_US + ISR_LATE_US);
+            if(blackout_us > 0 && random(0, 7) == 0) fire_at += random(0, blackout_us);
+            if(before(fire_at, micros())) fire_at = micros();
+        }
+        uint32_t next = end;
+        if(timer.armed && before(fire_at, next)) next = fire_at;
+        if(before(sender_at, next)) next = sender_at;
+        if(before(frame_at, next)) next = frame_at;
+        host_now_us = next;
+
+        if(timer.armed && fire_at == next) timer.fire();
+        if(frame_at == next) {
+            host_usb.frame();
+            frame_at += FRAME_US;
+        }
+        if(sender_at == next) {
+            Midi::poll();
+            sender_at = next + random(1, SLICE_US);
+        }
+    }
+}
+
+static void run_for(const uint32_t us) {
+    run_until(micros() + us);
+}
+
+// holds a chord, plays STEPS steps of it, lets go. returns the step length
+static uint32_t segment(LatencyHistogram& steps) {
+    ArpConfig c;
+    c.mode = static_cast<ArpMode>(random(static_cast<uint8_t>(ArpMode::up), static_cast<uint8_t>(ArpMode::as_played)));
+    c.bpm = random(40, 300);
+    c.steps_per_beat = random(1, 6);
+    c.gate = random(5, 95);
+    c.octaves = random(1, 3);
+    const uint32_t step_us = 60'000'000ul / (c.bpm * c.steps_per_beat);
+    gate_us = std::max<uint32_t>(step_us * c.gate / 100, 1);
+    blackout_us = hold_off ? 2 * step_us : 0;
+
+    uint8_t keys[NOTE_KEYS_LEN];
+    for(uint8_t i = 0; i < NOTE_KEYS_LEN; i++) keys[i] = i;
+    std::shuffle(keys, keys + NOTE_KEYS_LEN, rng);
+    const uint8_t held_len = random(1, 5);
+    for(uint8_t i = 0; i < held_len; i++) input_stream.push_note(keys[i], random(1, 255), true, micros());
+    event_pump.pump();
+    on_ts.clear();
+    arp_configure(c);
+    run_for(step_us * STEPS);
+
+    c.mode = ArpMode::off;
+    arp_configure(c);
+    run_for(2 * step_us + blackout_us); // the last step, and the interrupt that stops it
+    CHECK(!running.load());
+    for(uint8_t i = 0; i < held_len; i++) input_stream.push_note(keys[i], 0, false, micros());
+    event_pump.pump();
+    run_for(SLICE_US + FRAME_US);
+    CHECK_EQ(sounding_note, NOTE_UNMAPPED);
+
+    for(size_t i = 1; i < on_ts.size(); i++) {
+        steps.record(std::abs(static_cast<int32_t>(on_ts[i] - on_ts[i - 1] - step_us)));
+    }
+    return step_us;
+}
+
+int main(const int argc, const char** argv) {
+    const uint32_t segments = argc > 1 ? strtoul(argv[1], nullptr, 10) : 300;
+    host_usb.on_packet = on_packet;
+    Serial.enabled = false; // midi.cpp logs every note
+    Midi::init();
+    arp_init();
+    event_pump.add(&input_stream);
+
+    // the interrupt on time, give or take the timer's rounding
+    LatencyHistogram steps = {};
+    uint32_t longest_step = 0;
+    for(uint32_t i = 0; i < segments; i++) longest_step = std::max(longest_step, segment(steps));
+    Serial.enabled = true;
+
+    // a step (or a gate) is off by the interrupt being late plus the sender's wait, either end
+    constexpr uint32_t JITTER_US = ISR_LATE_US + SLICE_US;
+    CHECK(steps.count > 0);
+    CHECK(steps.max_us <= 2 * JITTER_US);
+    CHECK(gates.max_us <= 2 * JITTER_US);
+    CHECK_EQ(unpaired, 0);
+    CHECK_EQ(sequenced.count, events);
+    CHECK(sequenced.max_us <= JITTER_US);
+    CHECK(timer.min_delay >= 1);
+    CHECK(timer.max_delay <= longest_step);
+    CHECK_EQ(Midi::stats().seq_dropped, 0);
+    printf("on time: %u sequenced events\n", events);
+    steps.print("step length error");
+    gates.print("gate length error");
+    sequenced.print("sequenced due -> submit");
+    printf("  timer triggered %u times for %.0f to %.0f us\n", timer.triggers, timer.min_delay, timer.max_delay);
+
+    // the interrupt held off now and then, so steps and gates come due while it can't run
+    Serial.enabled = false;
+    steps = {};
+    gates = {};
+    sequenced = {};
+    timer.min_delay = DBL_MAX;
+    timer.max_delay = -DBL_MAX;
+    const uint32_t before_events = events;
+    longest_step = 0;
+    hold_off = true;
+    for(uint32_t i = 0; i < segments; i++) longest_step = std::max(longest_step, segment(steps));
+    Serial.enabled = true;
+
+    CHECK_EQ(unpaired, 0);
+    CHECK_EQ(sequenced.count, events - before_events);
+    CHECK(timer.min_delay >= 1);
+    CHECK(timer.max_delay <= longest_step);
+    CHECK_EQ(Midi::stats().seq_dropped, 0);
+    printf("held off: %u sequenced events\n", events - before_events);
+    steps.print("step length error");
+    sequenced.print("sequenced due -> submit");
+    printf("  timer triggered for %.0f to %.0f us\n", timer.min_delay, timer.max_delay);
+
+    arp_print_stats(false);
+    return check_exit("arp_bench");
+}
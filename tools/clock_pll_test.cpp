@@ -0,0 +1,158 @@
+// ClockPll (src/midi/clock_pll.hpp) against synthetic midi clock: ticks at a steady tempo, seen
+// the way usb delivers them (at the next 1 ms frame, plus some scheduling noise). checks how
+// long it takes to lock, how close the filtered tempo and phase get, and that tempo jumps and
+// dropped ticks relock instead of slewing
+//
+//   g++ -std=gnu++17 -O2 -Wall -Wextra -Isrc -Itools tools/clock_pll_test.cpp -o clock_pll_test
+//   ./clock_pll_test
+
+#include <cmath>
+#include <random>
+#include "host_check.hpp"
+#include "midi/clock_pll.hpp"
+
+constexpr uint32_t FRAME_US = 1000; // full speed usb
+constexpr uint32_t NOISE_US = 100; // the usb interrupt and the thread that reads the tick
+constexpr uint32_t LOCK_BEATS = 2; // most we'll wait for a lock from the first tick
+
+static std::mt19937 rng(1);
+
+// the clock source's ticks, and when we'd see them
+struct TickStream {
+    double period_us;
+    double t;
+
+    [[nodiscard]] uint32_t seen(const double at) const {
+        std::uniform_int_distribution<uint32_t> noise(0, NOISE_US);
+        return static_cast<uint32_t>(std::ceil(at / FRAME_US)) * FRAME_US + noise(rng);
+    }
+
+    uint32_t next() {
+        const uint32_t ts = seen(t);
+        t += period_us;
+        return ts;
+    }
+};
+
+static double period_of(const double bpm) {
+    return 60'000'000.0 / (bpm * CLOCK_PPQN);
+}
+
+// feeds ticks until locked, returns how many that took (or UINT32_MAX)
+static uint32_t ticks_to_lock(ClockPll& pll, TickStream& stream, const uint32_t limit) {
+    for(uint32_t i = 1; i <= limit; i++) {
+        pll.tick(stream.next());
+        if(pll.beat_clock().locked) return i;
+    }
+    return UINT32_MAX;
+}
+
+static void steady(const double bpm) {
+    ClockPll pll;
+    TickStream stream = { period_of(bpm), 12345.0 };
+    const uint32_t lock = ticks_to_lock(pll, stream, LOCK_BEATS * CLOCK_PPQN);
+    CHECK(lock <= LOCK_BEATS * CLOCK_PPQN);
+
+    // then a while of steady clock: tempo within 0.1%, phase within a quarter frame
+    double worst_tempo = 0;
+    double worst_phase = 0;
+    for(uint32_t i = 0; i < 16 * CLOCK_PPQN; i++) {
+        const double true_ts = stream.t;
+        pll.tick(stream.next());
+        const auto& c = pll.beat_clock();
+        CHECK(c.locked);
+        worst_tempo = std::fmax(worst_tempo, std::fabs(c.bpm() - bpm) / bpm);
+        // ticks are seen up to a frame late, so the filtered time sits half a frame after the real one
+        const double delay = (FRAME_US + NOISE_US) / 2.0;
+        worst_phase = std::fmax(worst_phase, std::fabs(static_cast<double>(c.tick_us) - true_ts - delay));
+    }
+    CHECK(worst_tempo < 0.001);
+    CHECK(worst_phase < FRAME_US / 4.0);
+    CHECK_EQ(pll.stats().resyncs, 0);
+    CHECK_EQ(pll.stats().unlocks, 0);
+    CHECK(pll.stats().jitter_us < FRAME_US / 2.0);
+    printf("%6.1f bpm: locked after %2u ticks, worst tempo error %.3f%%, worst phase error %4.0f us, jitter %3.0f us\n",
+        bpm, lock, worst_tempo * 100, worst_phase, pll.stats().jitter_us);
+}
+
+static void tempo_jump() {
+    ClockPll pll;
+    TickStream stream = { period_of(120), 0 };
+    CHECK(ticks_to_lock(pll, stream, LOCK_BEATS * CLOCK_PPQN) != UINT32_MAX);
+    for(uint32_t i = 0; i < 4 * CLOCK_PPQN; i++) pll.tick(stream.next());
+
+    // far enough that the first tick misses the prediction by more than half a period
+    stream.period_us = period_of(60);
+    pll.tick(stream.next()); // the last one at the old tempo
+    pll.tick(stream.next());
+    CHECK_EQ(pll.stats().resyncs, 1);
+    CHECK(!pll.beat_clock().locked);
+    CHECK(ticks_to_lock(pll, stream, LOCK_BEATS * CLOCK_PPQN) != UINT32_MAX);
+    CHECK(std::fabs(pll.beat_clock().bpm() - 60) < 0.5);
+
+    // a small change is followed without starting over
+    stream.period_us = period_of(62);
+    for(uint32_t i = 0; i < LOCK_BEATS * CLOCK_PPQN; i++) pll.tick(stream.next());
+    CHECK_EQ(pll.stats().resyncs, 1);
+    CHECK(pll.beat_clock().locked);
+    CHECK(std::fabs(pll.beat_clock().bpm() - 62) < 0.5);
+}
+
+static void dropped_ticks() {
+    ClockPll pll;
+    TickStream stream = { period_of(120), 0 };
+    CHECK(ticks_to_lock(pll, stream, LOCK_BEATS * CLOCK_PPQN) != UINT32_MAX);
+    stream.next(); // lost
+    stream.next();
+    pll.tick(stream.next());
+    CHECK(pll.stats().resyncs == 1);
+    CHECK(!pll.beat_clock().locked);
+    // the gap isn't taken as the new tempo
+    CHECK(ticks_to_lock(pll, stream, LOCK_BEATS * CLOCK_PPQN) != UINT32_MAX);
+    CHECK(std::fabs(pll.beat_clock().bpm() - 120) < 1);
+}
+
+static void transport() {
+    ClockPll pll;
+    TickStream stream = { period_of(120), 0 };
+    pll.start();
+    pll.tick(stream.next());
+    CHECK(pll.beat_clock().running);
+    CHECK_EQ(pll.beat_clock().tick, 0);
+    CHECK_EQ(pll.beat_clock().ticks_at(5000), 0); // no estimate yet
+    for(uint32_t i = 0; i < 2 * CLOCK_PPQN; i++) pll.tick(stream.next());
+    const auto& c = pll.beat_clock();
+    CHECK_EQ(c.tick, 2 * CLOCK_PPQN);
+    // between ticks it interpolates, but never runs more than a tick ahead of the last one
+    CHECK(std::fabs(c.ticks_at(c.tick_us + static_cast<uint32_t>(c.period_us / 2)) - (c.tick + 0.5f)) < 0.01f);
+    CHECK_EQ(c.ticks_at(c.tick_us + 10 * FRAME_US * 100), c.tick + 1);
+    CHECK_EQ(c.ticks_at(c.tick_us - 100), c.tick);
+    CHECK(std::fabs(c.beats_at(c.tick_us) - 2) < 0.01f);
+
+    pll.stop();
+    CHECK(!c.running);
+    pll.resume();
+    pll.tick(stream.next());
+    CHECK_EQ(c.tick, 2 * CLOCK_PPQN + 1); // continue keeps counting
+    pll.start();
+    pll.tick(stream.next());
+    CHECK_EQ(c.tick, 0);
+}
+
+static void out_of_range() {
+    // 10 bpm isn't a clock, so no estimate and no lock
+    ClockPll pll;
+    TickStream stream = { period_of(10), 0 };
+    for(uint8_t i = 0; i < 50; i++) pll.tick(stream.next());
+    CHECK(!pll.beat_clock().locked);
+    CHECK_EQ(pll.beat_clock().period_us, 0);
+}
+
+int main() {
+    for(const double bpm : { 30.0, 60.0, 97.3, 120.0, 174.0, 240.0, 300.0 }) steady(bpm);
+    tempo_jump();
+    dropped_ticks();
+    transport();
+    out_of_range();
+    return check_exit("clock_pll");
+}
@@ -0,0 +1,89 @@
+// DinOut (src/midi/din_out.hpp) against a stub uart: running status, all or nothing queueing,
+// the note off reserve, and pump() only writing what the sink has room for
+//
+//   g++ -std=gnu++17 -O2 -Wall -Wextra -Isrc -Itools tools/din_out_test.cpp -o din_out_test
+//   ./din_out_test
+
+#include <vector>
+#include "host_check.hpp"
+#include "midi/din_out.hpp"
+
+struct StubSink {
+    std::vector<uint8_t> written;
+    int room = 64; // what the uart's tx buffer has free this pump
+
+    int availableForWrite() { return room; }
+    size_t write(const uint8_t b) {
+        written.push_back(b);
+        room--;
+        return 1;
+    }
+};
+
+static void running_status() {
+    StubSink sink;
+    DinOut<StubSink, 64, 16> din(sink);
+    CHECK(din.note_on(1, 60, 100));
+    CHECK(din.note_on(1, 64, 100));
+    CHECK(din.note_off(1, 60)); // same status as the note ons
+    CHECK(din.note_on(2, 60, 100));
+    CHECK(din.control_change(2, 7, 90));
+    din.pump();
+    const std::vector<uint8_t> expected = { 0x90, 60, 100, 64, 100, 60, 0, 0x91, 60, 100, 0xB1, 7, 90 };
+    CHECK(sink.written == expected);
+    CHECK_EQ(din.stats().running_status_saved, 2);
+    CHECK_EQ(din.stats().bytes, expected.size());
+
+    // system messages cancel it
+    sink.written.clear();
+    const uint8_t song_select[2] = { 0xF3, 5 };
+    CHECK(din.raw(song_select, 2));
+    CHECK(din.control_change(2, 7, 91));
+    din.pump();
+    CHECK((sink.written == std::vector<uint8_t>{ 0xF3, 5, 0xB1, 7, 91 }));
+}
+
+static void pump_respects_room() {
+    StubSink sink;
+    sink.room = 4;
+    DinOut<StubSink, 64, 16> din(sink);
+    for(uint8_t i = 0; i < 5; i++) din.control_change(1, i, i);
+    CHECK_EQ(din.pump(), 4);
+    CHECK_EQ(sink.written.size(), 4);
+    sink.room = 0;
+    CHECK_EQ(din.pump(), 0);
+    sink.room = 100;
+    CHECK_EQ(din.pump(), 7); // 1 status + 5 * 2 data - 4 already out
+    CHECK_EQ(din.depth(), 0);
+}
+
+static void note_off_reserve() {
+    StubSink sink;
+    DinOut<StubSink, 32, 12> din(sink);
+    // fill everything but the reserve with ccs on different channels so nothing shares a status
+    uint8_t sent = 0;
+    while(din.control_change(1 + sent % 16, 1, 1)) sent++;
+    CHECK_EQ(sent, (32 - 12) / 3);
+    CHECK_EQ(din.room(), (32 - 12) % 3);
+    CHECK(!din.note_on(3, 60, 100)); // note ons don't get the reserve
+    CHECK(din.realtime(0xF8)); // one byte still fits outside it
+    CHECK_EQ(din.room(), 1);
+    // note offs do (0x80, or 0x90 with velocity 0 like these)
+    for(uint8_t i = 0; i < 4; i++) CHECK(din.note_off(5 + i, 60));
+    CHECK(!din.send(0x80, 61, 64, 2)); // reserve used up
+    CHECK_EQ(din.stats().offs_dropped, 1);
+    CHECK_EQ(din.depth(), 32 - 1);
+
+    // all or nothing: a message never goes in half
+    const uint8_t bytes[3] = { 0xF2, 1, 2 };
+    const size_t before = din.depth();
+    CHECK(!din.raw(bytes, 3));
+    CHECK_EQ(din.depth(), before);
+}
+
+int main() {
+    running_status();
+    pump_respects_room();
+    note_off_reserve();
+    return check_exit("din_out");
+}
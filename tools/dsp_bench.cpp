@@ -0,0 +1,55 @@
+// times the dsp kernels (src/dsp) on the host, through their portable path, on audio sized
+// blocks. for comparing changes to a kernel, the numbers on the teensy come from the simd path
+//
+//   g++ -std=gnu++17 -O2 -Isrc tools/dsp_bench.cpp src/dsp/dsp.cpp -o dsp_bench
+//   ./dsp_bench
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include "dsp/dsp.hpp"
+
+constexpr uint16_t BLOCK = 128; // AUDIO_BLOCK_SAMPLES on the teensy
+constexpr uint32_t BLOCKS = 200000;
+constexpr uint8_t TABLE_BITS = 9;
+
+static int16_t a[BLOCK];
+static int16_t b[BLOCK];
+static float f[BLOCK];
+static int16_t table[(1 << TABLE_BITS) + 1];
+static volatile int64_t sink; // so the compiler can't drop the work
+
+template<typename F>
+static void bench(const char* name, F&& fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < BLOCKS; i++) fn();
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-16s %8.1f ns per block %8.1f Msamples/s\n", name, ns / BLOCKS, BLOCKS * static_cast<double>(BLOCK) / ns * 1000);
+}
+
+int main() {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int16_t> dist(INT16_MIN, INT16_MAX);
+    for(uint16_t i = 0; i < BLOCK; i++) {
+        a[i] = dist(rng);
+        b[i] = dist(rng);
+        f[i] = a[i] / 32768.0f;
+    }
+    for(uint16_t i = 0; i <= 1 << TABLE_BITS; i++) {
+        table[i] = static_cast<int16_t>(32767 * std::sin(2 * M_PI * i / (1 << TABLE_BITS)));
+    }
+
+    printf("portable path, %d samples per block\n", BLOCK);
+    bench("gain_q15", [] { dsp_gain_q15(a, BLOCK, DSP_GAIN_UNITY * 3 / 4); });
+    bench("mix_q15", [] { dsp_mix_q15(a, b, BLOCK, DSP_GAIN_UNITY / 2); });
+    bench("add_q15", [] { dsp_add_q15(a, b, BLOCK); });
+    bench("dot_q15", [] { sink = dsp_dot_q15(a, b, BLOCK); });
+    uint32_t phase = 0;
+    bench("table_q15", [&] { dsp_table_q15(a, BLOCK, table, TABLE_BITS, phase, 0x01234567); });
+    bench("float_to_q15", [] { dsp_float_to_q15(b, f, BLOCK); });
+    DspBiquad lp = {};
+    dsp_biquad_lowpass(lp, 44100, 1000, 0.707f);
+    bench("biquad", [&] { dsp_biquad(lp, f, BLOCK); });
+    return 0;
+}
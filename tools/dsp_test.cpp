@@ -0,0 +1,31 @@
+// runs dsp_selftest (src/dsp/dsp_selftest.cpp): every wrapper and kernel against dsp_ref on
+// random inputs. on linux that's the portable path, so it checks the packed kernels against the
+// one sample at a time versions. built for armv7 (which has the same dsp instructions as the
+// m7) and run under qemu it checks the asm too. on the teensy itself, DSP_SELFTEST in main.cpp
+//
+//   g++ -std=gnu++17 -O2 -Wall -Wextra -Isrc -Itools tools/dsp_test.cpp src/dsp/dsp.cpp src/dsp/dsp_selftest.cpp -o dsp_test
+//   ./dsp_test [rounds]
+//
+//   arm-linux-gnueabihf-g++ -std=gnu++17 -O2 -march=armv7-a -mthumb -static -Isrc -Itools tools/dsp_test.cpp src/dsp/dsp.cpp src/dsp/dsp_selftest.cpp -o dsp_test_arm
+//   qemu-arm ./dsp_test_arm
+
+#include <cstdlib>
+#include <initializer_list>
+#include "host_check.hpp"
+#include "dsp/dsp_selftest.hpp"
+
+int main(const int argc, const char** argv) {
+    const uint32_t rounds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+#ifdef DSP_SIMD
+    printf("simd path\n");
+#else
+    printf("portable path\n");
+#endif
+    for(const uint32_t seed : { 1u, 0xC0FFEEu, 0xDEADBEEFu }) {
+        const auto r = dsp_selftest(seed, rounds);
+        CHECK_EQ(r.failures, 0);
+        CHECK(r.checks > 0);
+        if(r.failures > 0) printf("seed %u: %u/%u failed, first %s\n", seed, r.failures, r.checks, r.first_failure);
+    }
+    return check_exit("dsp");
+}
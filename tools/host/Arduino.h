@@ -0,0 +1,80 @@
+// just enough of Arduino.h for the host programs in tools/ to build firmware sources, put
+// -Itools/host before -Isrc. time is a fake clock that only moves when the program moves it
+// (host_advance) or the firmware busy waits (delayMicroseconds), so runs are repeatable. the
+// gpio calls are only declared, the program that links the kscan driver is the hardware and
+// defines them
+
+#pragma once
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+#define RISING 3
+
+// the usb interrupt can't preempt anything on one host thread
+#define IRQ_USB1 113
+#define NVIC_ENABLE_IRQ(n) ((void) (n))
+#define NVIC_DISABLE_IRQ(n) ((void) (n))
+
+// starts well away from 0, the latency bench uses 0 for "no timestamp"
+inline uint32_t host_now_us = 1'000'000;
+
+inline uint32_t micros() { return host_now_us; }
+inline uint32_t millis() { return host_now_us / 1000; }
+inline void host_advance(const uint32_t us) { host_now_us += us; }
+inline void delayMicroseconds(const uint32_t us) { host_advance(us); }
+inline void delay(const uint32_t ms) { host_advance(ms * 1000); }
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+uint8_t digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*function)(), int mode);
+void detachInterrupt(uint8_t pin);
+
+// not checked as printf, the firmware prints uint32_t with %lu which is right on the teensy.
+// a program can turn it off while the firmware's debug logging would drown out its own output
+struct HostSerial {
+    bool enabled = true;
+
+    int printf(const char* format, ...) {
+        if(!enabled) return 0;
+        va_list args;
+        va_start(args, format);
+        const int n = vprintf(format, args);
+        va_end(args);
+        return n;
+    }
+
+    int println(const char* s) { return enabled ? ::printf("%s\n", s) : 0; }
+};
+
+inline HostSerial Serial;
+
+inline int vdprintf(HostSerial& serial, const char* format, va_list args) {
+    return serial.enabled ? vprintf(format, args) : 0;
+}
+
+// a uart with nothing on the other end: never has anything to read, takes everything written
+struct HardwareSerial {
+    uint32_t written = 0;
+
+    void begin(uint32_t) {}
+    int available() { return 0; }
+    int read() { return -1; }
+    int availableForWrite() { return 64; }
+    size_t write(uint8_t) {
+        written++;
+        return 1;
+    }
+};
+
+inline HardwareSerial Serial1;
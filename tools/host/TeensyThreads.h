@@ -0,0 +1,39 @@
+// teensythreads for the host programs in tools/: everything runs on the one host thread, so the
+// locks have nothing to do and no thread ever starts. the program calls the firmware's poll
+// functions itself, in whatever order it wants to simulate
+
+#pragma once
+
+#include "Arduino.h"
+
+class Threads {
+public:
+    class Mutex {
+    public:
+        int lock(unsigned int = 0) { return 1; }
+        int try_lock() { return 1; }
+        int unlock() { return 1; }
+    };
+
+    class Scope {
+    public:
+        explicit Scope(Mutex& m) : m(m) { m.lock(); }
+        ~Scope() { m.unlock(); }
+
+    private:
+        Mutex& m;
+    };
+
+    // the firmware's threads loop forever, so they never start here. the ids are only for the stack stats
+    int count = 0;
+
+    int addThread(void (*)()) { return count++; }
+    int addThread(void (*)(void*), void* = nullptr, int = -1, void* = nullptr) { return count++; }
+
+    static void yield() {}
+    void delay(const int ms) { ::delay(ms); }
+    int getStackUsed(int) { return 0; }
+    int getStackRemaining(int) { return 0; }
+};
+
+inline Threads threads;
@@ -0,0 +1,50 @@
+// teensytimertool's OneShotTimer for the host programs in tools/, on the fake clock in Arduino.h.
+// nothing fires by itself: the program looks at when a timer is due and calls its callback, as
+// early or late as it wants the interrupt to be. keeps the delays it was triggered with so a
+// program can check them
+
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include "Arduino.h"
+
+namespace TeensyTimerTool {
+    struct TimerGenerator {};
+    inline TimerGenerator* const GPT1 = nullptr;
+    inline TimerGenerator* const GPT2 = nullptr;
+
+    using callback_t = void (*)();
+
+    class OneShotTimer {
+    public:
+        callback_t callback = nullptr;
+        bool armed = false;
+        uint32_t due = 0;
+        // what trigger() was asked for in us, before any conversion the hardware would do
+        double min_delay = DBL_MAX;
+        double max_delay = -DBL_MAX;
+        uint32_t triggers = 0;
+
+        explicit OneShotTimer(TimerGenerator* = nullptr) {}
+
+        void begin(const callback_t cb) { callback = cb; }
+
+        template<typename T>
+        void trigger(const T delay) {
+            const double d = static_cast<double>(delay);
+            if(d < min_delay) min_delay = d;
+            if(d > max_delay) max_delay = d;
+            triggers++;
+            armed = true;
+            // a negative delay is a huge one to the hardware, as far off as the fake clock can say
+            due = micros() + static_cast<uint32_t>(d < 0 || d > INT32_MAX ? INT32_MAX : d);
+        }
+
+        // the interrupt
+        void fire() {
+            armed = false;
+            callback();
+        }
+    };
+}
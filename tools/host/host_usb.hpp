@@ -0,0 +1,55 @@
+// the usb stack for host programs that link the midi sender (src/hardware/midi.cpp), include it
+// in one file: defines usb_midi_write_packed() and usb_midi_flush_output() on the fake clock.
+// events fill a usb packet and it goes when it's full, when the sender flushes, or at the next
+// start of frame (host_usb.frame(), which the program calls every frame like the usb interrupt)
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <Arduino.h>
+#include <usb_dev.h>
+#include <usb_midi.h>
+
+struct HostUsbEvent {
+    uint32_t packet; // cable/code index in the low byte, then the midi bytes
+    uint32_t written_us; // when the sender handed it to the stack
+};
+
+struct HostUsb {
+    std::vector<HostUsbEvent> building;
+    // called with every packet as it goes to the host
+    void (*on_packet)(const std::vector<HostUsbEvent>& events, uint32_t sent_us) = nullptr;
+    uint32_t packets = 0;
+    uint32_t frame_flushes = 0;
+
+    uint8_t events_per_packet() const { return usb_high_speed ? 512 / 4 : 64 / 4; }
+
+    void send() {
+        if(building.empty()) return;
+        packets++;
+        if(on_packet != nullptr) on_packet(building, micros());
+        building.clear();
+    }
+
+    void write(const uint32_t packet) {
+        building.push_back({ packet, micros() });
+        if(building.size() == events_per_packet()) send();
+    }
+
+    // the start of frame handler sends whatever's there
+    void frame() {
+        if(!building.empty()) frame_flushes++;
+        send();
+    }
+};
+
+inline HostUsb host_usb;
+
+void usb_midi_write_packed(const uint32_t n) {
+    host_usb.write(n);
+}
+
+void usb_midi_flush_output() {
+    host_usb.send();
+}
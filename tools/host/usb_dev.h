@@ -0,0 +1,8 @@
+// teensy's usb_dev.h for the host programs in tools/. a program can switch to full speed to
+// get 16 event packets instead of 128
+
+#pragma once
+
+#include <cstdint>
+
+inline volatile uint8_t usb_high_speed = 1;
@@ -0,0 +1,31 @@
+// teensy's usb_midi.h for the host programs in tools/: the host never sends anything, and the
+// program that links the midi sender is the usb stack, it defines usb_midi_write_packed() and
+// usb_midi_flush_output()
+
+#pragma once
+
+#include <cstdint>
+
+void usb_midi_write_packed(uint32_t n);
+void usb_midi_flush_output();
+
+class usb_midi_class {
+public:
+    static constexpr uint8_t SystemExclusive = 0xF0;
+
+    bool read() { return false; }
+    uint8_t getType() { return 0; }
+    uint8_t getChannel() { return 0; }
+    uint8_t getData1() { return 0; }
+    uint8_t getData2() { return 0; }
+
+    void setHandleControlChange(void (*)(uint8_t, uint8_t, uint8_t)) {}
+    void setHandleProgramChange(void (*)(uint8_t, uint8_t)) {}
+    void setHandleClock(void (*)()) {}
+    void setHandleStart(void (*)()) {}
+    void setHandleContinue(void (*)()) {}
+    void setHandleStop(void (*)()) {}
+    void setHandleSystemExclusive(void (*)(const uint8_t*, uint16_t, bool)) {}
+};
+
+inline usb_midi_class usbMIDI;
@@ -0,0 +1,11 @@
+// teensy's usb_names.h for the host programs in tools/, sized instead of a flexible array
+
+#pragma once
+
+#include <cstdint>
+
+struct usb_string_descriptor_struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t wString[32];
+};
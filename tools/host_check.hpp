@@ -0,0 +1,32 @@
+// tiny check macros for the host programs in tools/. a failed check prints where and keeps going,
+// and check_exit() makes the program's exit status say whether everything passed
+
+#pragma once
+
+#include <cstdio>
+
+inline int check_failures = 0;
+inline int check_count = 0;
+
+#define CHECK(cond) do { \
+    check_count++; \
+    if(!(cond)) { \
+        check_failures++; \
+        printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while(0)
+
+#define CHECK_EQ(a, b) do { \
+    check_count++; \
+    const long long check_a = static_cast<long long>(a); \
+    const long long check_b = static_cast<long long>(b); \
+    if(check_a != check_b) { \
+        check_failures++; \
+        printf("FAIL %s:%d: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, check_a, check_b); \
+    } \
+} while(0)
+
+inline int check_exit(const char* name) {
+    printf("%s: %d/%d checks passed\n", name, check_count - check_failures, check_count);
+    return check_failures == 0 ? 0 : 1;
+}
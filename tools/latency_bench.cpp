@@ -0,0 +1,273 @@
+// the latency bench (src/util/latency.cpp) on the real key path: the kscan matrix driver,
+// debounce, velocity and the midi sender, built for the host against a simulated matrix of
+// bouncing switches and a usb stack that packs events into full speed packets. chords of keys
+// go down with a random travel between the upper and lower switch (some long enough for a
+// velocity timeout), and every note on that reaches usb is compared with when its lower switch
+// really closed. the firmware's stage histograms have to account for every note and agree with
+// that within a scan, then the report prints like it does on the teensy.
+// everything runs on one host thread on a fake clock: the timer service's schedulers every
+// TICK_US, and the sender at most a round robin slice after that, so what's measured is the
+// scan timing, the debouncer and the code path, not the teensy's thread switching
+//
+//   g++ -std=gnu++17 -O2 -Wall -Wextra -Wno-format -DLATENCY_BENCH -Itools/host -Isrc -Itools -Ilib/TeensyTimerTool/src tools/latency_bench.cpp src/kscan/kscan_gpio_matrix.cpp src/kscan/debounce.cpp src/kscan/velocity.cpp src/hardware/midi.cpp src/input/input_stream.cpp src/midi/note_map.cpp src/midi/mpe.cpp src/midi/arp.cpp src/midi/midi_clock.cpp src/scheduler/timer_service.cpp -o latency_bench
+//   ./latency_bench [rounds]
+//
+// (-Wno-format: the firmware prints uint32_t with %lu, which is right on the teensy)
+
+#include "util/latency.cpp"
+
+#include <algorithm>
+#include <queue>
+#include <random>
+#include <vector>
+#include "host_check.hpp"
+#include "host_usb.hpp"
+#include "hardware/midi.hpp"
+#include "kscan/velocity.hpp"
+#include "midi/note_map.hpp"
+
+constexpr uint32_t TICK_US = 10;
+constexpr uint32_t SLICE_US = 100; // the sender waits for up to one slice to get its turn
+constexpr uint32_t FRAME_US = 1000; // full speed start of frame
+constexpr uint32_t SCAN_US = KSCAN_DEBOUNCE_SCAN_PERIOD_MS * 1000;
+// a whole scan with its delays, and when in it the last column is read
+constexpr uint32_t SCAN_LEN_US = 5 + OUTPUTS_LEN * KSCAN_COL_DELAY_US;
+constexpr uint32_t BOUNCE_US = 400; // contacts settle within this
+constexpr uint8_t KEYS = NOTE_KEYS_LEN;
+
+static std::mt19937 rng(1);
+
+static uint32_t random(const uint32_t lo, const uint32_t hi) {
+    return std::uniform_int_distribution<uint32_t>(lo, hi)(rng);
+}
+
+// the matrix: which columns are driven, which switches are closed, and what happens next
+
+struct Transition {
+    uint32_t at;
+    uint8_t index; // matrix index, row * COLS_LEN + column
+    bool closed;
+
+    bool operator>(const Transition& o) const { return at > o.at; }
+};
+
+static std::priority_queue<Transition, std::vector<Transition>, std::greater<>> transitions;
+static bool closed[MATRIX_LEN];
+static bool driven[OUTPUTS_LEN];
+static void (*isr[INPUTS_LEN])() = {};
+static bool isr_level[INPUTS_LEN];
+
+static int8_t find_pin(const int* pins, const uint8_t len, const uint8_t pin) {
+    for(uint8_t i = 0; i < len; i++) {
+        if(pins[i] == pin) return i;
+    }
+    return -1;
+}
+
+static void settle() {
+    while(!transitions.empty() && transitions.top().at <= micros()) {
+        closed[transitions.top().index] = transitions.top().closed;
+        transitions.pop();
+    }
+}
+
+static bool row_level(const uint8_t row) {
+    settle();
+    for(uint8_t c = 0; c < OUTPUTS_LEN; c++) {
+        if(driven[c] && closed[row * COLS_LEN + c]) return true;
+    }
+    return false;
+}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(const uint8_t pin, const uint8_t val) {
+    const int8_t c = find_pin(matrix_outputs, OUTPUTS_LEN, pin);
+    if(c >= 0) driven[c] = val == HIGH;
+}
+
+uint8_t digitalRead(const uint8_t pin) {
+    const int8_t r = find_pin(matrix_inputs, INPUTS_LEN, pin);
+    return r >= 0 && row_level(r) ? HIGH : LOW;
+}
+
+void attachInterrupt(const uint8_t pin, void (*function)(), int) {
+    const int8_t r = find_pin(matrix_inputs, INPUTS_LEN, pin);
+    if(r < 0) return;
+    isr[r] = function;
+    isr_level[r] = row_level(r); // only edges from here on
+}
+
+void detachInterrupt(const uint8_t pin) {
+    const int8_t r = find_pin(matrix_inputs, INPUTS_LEN, pin);
+    if(r >= 0) isr[r] = nullptr;
+}
+
+static void fire_interrupts() {
+    for(uint8_t r = 0; r < INPUTS_LEN; r++) {
+        if(isr[r] == nullptr) continue;
+        const bool level = row_level(r);
+        const bool rising = level && !isr_level[r];
+        isr_level[r] = level;
+        if(rising) isr[r](); // detaches every input, so the rest see nullptr
+    }
+}
+
+// a contact closing (or opening) at t, chattering for a bit first. returns when it first touched
+static uint32_t contact(const uint8_t index, const uint32_t t, const bool close) {
+    uint32_t at = t;
+    for(uint8_t b = random(0, 3); b > 0; b--) {
+        transitions.push({ at, index, close });
+        at += random(10, BOUNCE_US / 6);
+        transitions.push({ at, index, !close });
+        at += random(10, BOUNCE_US / 6);
+    }
+    transitions.push({ at, index, close });
+    return t;
+}
+
+// what each key's note on should be measured against
+
+struct Press {
+    uint32_t lower_ts; // first touch of the lower switch, 0 if the key isn't down
+    bool timeout; // the lower switch comes too late, velocity plays it from the upper one
+};
+
+static Press presses[KEYS];
+static uint32_t key_notes = 0; // note ons from a lower switch
+static uint32_t timeout_notes = 0;
+static LatencyHistogram truth; // lower switch to usb, what the total should be
+static uint32_t split_prefixes = 0;
+static uint32_t stray_notes = 0;
+
+static uint8_t lower_index(const uint8_t key) {
+    return (key / COLS_LEN * 2 + 1) * COLS_LEN + key % COLS_LEN;
+}
+
+static uint8_t upper_index(const uint8_t key) {
+    return key / COLS_LEN * 2 * COLS_LEN + key % COLS_LEN;
+}
+
+// a key going down at t and coming back up after a while, returns when it's all the way up
+static uint32_t press(const uint8_t key, const uint32_t t) {
+    const bool timeout = random(0, 9) == 0;
+    const uint32_t travel = timeout ? random(110'000, 150'000) : random(2'000, 60'000);
+    const uint32_t hold = random(20'000, 80'000);
+    contact(upper_index(key), t, true);
+    presses[key] = { contact(lower_index(key), t + travel, true), timeout };
+    const uint32_t up = t + travel + hold;
+    contact(lower_index(key), up, false);
+    contact(upper_index(key), up + random(1'000, 8'000), false);
+    return up + 10'000;
+}
+
+// the host side of usb: check every note on against its key
+static void on_packet(const std::vector<HostUsbEvent>& events, uint32_t) {
+    for(size_t i = 0; i < events.size(); i++) {
+        const uint32_t p = events[i].packet;
+        if((p & 0xF) != 0x9 || (p >> 24) == 0) continue;
+        // the high res velocity prefix has to come in the same packet, right before
+        if(i == 0 || (events[i - 1].packet & 0xFFFF) != ((0xB0 | (p >> 8 & 0xF)) << 8 | 0xB)
+            || (events[i - 1].packet >> 16 & 0xFF) != 0x58) split_prefixes++;
+        const uint8_t key = p >> 16 & 0x7F; // the chromatic map from note 0, so note == key
+        if(key >= KEYS || presses[key].lower_ts == 0) {
+            stray_notes++;
+            continue;
+        }
+        if(presses[key].timeout) {
+            timeout_notes++;
+        } else {
+            truth.record(events[i].written_us - presses[key].lower_ts);
+            key_notes++;
+        }
+        presses[key].lower_ts = 0;
+    }
+}
+
+static void run_until(const uint32_t end) {
+    static uint32_t sender_at = 0;
+    static uint32_t frame_at = 0;
+    while(static_cast<int32_t>(micros() - end) < 0) {
+        host_advance(TICK_US);
+        if(static_cast<int32_t>(micros() - frame_at) >= 0) {
+            host_usb.frame();
+            frame_at = micros() + FRAME_US;
+        }
+        fire_interrupts();
+        // the timer service, scans first
+        kscan_matrix_poll();
+        velocity_poll();
+        if(static_cast<int32_t>(micros() - sender_at) >= 0) {
+            Midi::poll();
+            sender_at = micros() + random(0, SLICE_US);
+        }
+    }
+}
+
+static void check_bound(const LatencyHistogram& h, const uint32_t max_us) {
+    CHECK(h.count > 0);
+    CHECK(h.max_us <= max_us);
+    if(h.max_us > max_us) printf("  max %u us, expected at most %u us\n", h.max_us, max_us);
+}
+
+int main(const int argc, const char** argv) {
+    const uint32_t rounds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+    usb_high_speed = 0; // 16 events a packet, so chords cross packet boundaries
+    host_usb.on_packet = on_packet;
+
+    Serial.enabled = false; // midi.cpp logs every note
+
+    // like main.cpp, minus the threads
+    kscan_matrix_init();
+    kscan_matrix_configure(velocity_kscan_handler, velocity_kscan_batch_handler);
+    velocity_configure(Midi::velocity_handler, Midi::flush);
+    velocity_init();
+    Midi::init();
+    kscan_matrix_enable();
+
+    uint8_t keys[KEYS];
+    for(uint8_t i = 0; i < KEYS; i++) keys[i] = i;
+    for(uint32_t round = 0; round < rounds; round++) {
+        // a chord, its keys pressed within a couple of ms of each other
+        std::shuffle(keys, keys + KEYS, rng);
+        const uint32_t t = micros() + random(0, SCAN_US);
+        uint32_t up = t;
+        for(uint8_t i = random(1, 6); i > 0; i--) up = std::max(up, press(keys[i - 1], t + random(0, 2'000)));
+        run_until(up);
+    }
+
+    Serial.enabled = true;
+
+    // every note on got there once, in one piece
+    CHECK_EQ(stray_notes, 0);
+    CHECK_EQ(split_prefixes, 0);
+    for(const auto& p : presses) CHECK_EQ(p.lower_ts, 0);
+    CHECK(timeout_notes > 0);
+
+    // and the firmware measured every one from a lower switch, and nothing else
+    CHECK_EQ(stages[0].count, key_notes);
+    CHECK_EQ(incomplete, 0);
+    CHECK_EQ(overflows, 0);
+    CHECK_EQ(in_flight.size(), 0);
+    for(uint8_t i = kscan; i < STAGES; i++) CHECK_EQ(stages[i].count, key_notes);
+
+    // the edge is the scan (or interrupt) that first saw the contact. a scan reads it up to a
+    // scan's length after its own time, and can miss it if it chattered open right then
+    const uint64_t n = key_notes;
+    CHECK(stages[0].total_us <= truth.total_us + n * (SCAN_LEN_US + TICK_US));
+    CHECK(stages[0].total_us + n * (SCAN_US + BOUNCE_US) >= truth.total_us);
+    check_bound(stages[0], truth.max_us + SCAN_LEN_US + TICK_US);
+    // the debouncer takes a press on the first contact, so it's reported by the scan it's read in
+    check_bound(stages[kscan], SCAN_LEN_US + TICK_US);
+    // velocity runs in the same call as the scan
+    check_bound(stages[decision], 0);
+    check_bound(stages[submit], SLICE_US + TICK_US);
+
+    printf("%u notes from the lower switch, %u from velocity timeouts, %u usb packets (%u sent by start of frame)\n",
+        key_notes, timeout_notes, host_usb.packets, host_usb.frame_flushes);
+    truth.print("lower switch -> usb (simulated)");
+    printf("  the firmware's total starts at the scan that saw the contact, on average %lld us after it touched\n",
+        (static_cast<long long>(truth.total_us) - static_cast<long long>(stages[0].total_us)) / static_cast<long long>(n == 0 ? 1 : n));
+    latency_print_report(false);
+    return check_exit("latency_bench");
+}
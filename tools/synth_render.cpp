@@ -0,0 +1,115 @@
+// runs the synth's render core (src/synth/synth_core.hpp) on linux: renders a test sequence to
+// a wav file to listen to, then times a block loop with every voice playing
+//
+//   g++ -std=gnu++17 -O2 -Isrc tools/synth_render.cpp -o synth_render
+//   ./synth_render [out.wav]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "synth/synth_core.hpp"
+
+constexpr float SAMPLE_RATE = 44100.0f;
+constexpr uint16_t BLOCK = 128; // AUDIO_BLOCK_SAMPLES on the teensy
+
+struct SeqEvent {
+    float at_s;
+    uint8_t note;
+    uint8_t velocity; // 0 for off
+};
+
+// chords that pile up past the voice count, so stealing gets exercised too
+static std::vector<SeqEvent> test_sequence() {
+    std::vector<SeqEvent> seq;
+    const uint8_t chords[4][4] = { { 48, 55, 60, 64 }, { 45, 52, 57, 60 }, { 41, 48, 53, 57 }, { 43, 50, 55, 59 } };
+    for(uint8_t bar = 0; bar < 8; bar++) {
+        const float t = bar * 1.0f;
+        for(uint8_t i = 0; i < 4; i++) {
+            const uint8_t note = chords[bar % 4][i] + (bar >= 4 ? 12 : 0);
+            seq.push_back({ t + i * 0.02f, note, static_cast<uint8_t>(120 + i * 30) });
+            seq.push_back({ t + 0.9f, note, 0 });
+        }
+        // a run on top, held over the bar line
+        for(uint8_t i = 0; i < 8; i++) {
+            const uint8_t note = 72 + chords[bar % 4][i % 4] % 12 + (i / 4) * 12;
+            seq.push_back({ t + i * 0.125f, note, 200 });
+            seq.push_back({ t + i * 0.125f + 0.6f, note, 0 });
+        }
+    }
+    std::sort(seq.begin(), seq.end(), [](const SeqEvent& a, const SeqEvent& b) { return a.at_s < b.at_s; });
+    return seq;
+}
+
+static void write_le(FILE* f, const uint32_t v, const uint8_t bytes) {
+    for(uint8_t i = 0; i < bytes; i++) fputc(v >> (8 * i) & 0xFF, f);
+}
+
+static bool write_wav(const char* path, const std::vector<int16_t>& samples) {
+    FILE* f = fopen(path, "wb");
+    if(f == nullptr) return false;
+    const uint32_t data_len = samples.size() * 2;
+    fwrite("RIFF", 1, 4, f);
+    write_le(f, 36 + data_len, 4);
+    fwrite("WAVEfmt ", 1, 8, f);
+    write_le(f, 16, 4);
+    write_le(f, 1, 2); // pcm
+    write_le(f, 1, 2); // mono
+    write_le(f, SAMPLE_RATE, 4);
+    write_le(f, SAMPLE_RATE * 2, 4);
+    write_le(f, 2, 2);
+    write_le(f, 16, 2);
+    fwrite("data", 1, 4, f);
+    write_le(f, data_len, 4);
+    fwrite(samples.data(), 2, samples.size(), f);
+    return fclose(f) == 0;
+}
+
+int main(const int argc, const char** argv) {
+    const char* path = argc > 1 ? argv[1] : "synth_render.wav";
+
+    SynthCore<SYNTH_VOICES> synth;
+    synth.configure(SAMPLE_RATE, {});
+
+    const auto seq = test_sequence();
+    const float length_s = seq.back().at_s + 1.5f;
+    std::vector<int16_t> out;
+    float buf[BLOCK];
+    size_t next = 0;
+    uint32_t max_voices = 0;
+    for(uint32_t block = 0; block * BLOCK < length_s * SAMPLE_RATE; block++) {
+        // events land on block boundaries, like they do in the audio interrupt
+        const float block_end_s = (block + 1) * BLOCK / SAMPLE_RATE;
+        for(; next < seq.size() && seq[next].at_s < block_end_s; next++) {
+            if(seq[next].velocity > 0) synth.note_on(seq[next].note, seq[next].velocity);
+            else synth.note_off(seq[next].note);
+        }
+        const uint8_t voices = synth.render(buf, BLOCK);
+        if(voices > max_voices) max_voices = voices;
+        for(const float s : buf) {
+            const float v = s * 32767.0f;
+            out.push_back(static_cast<int16_t>(v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v));
+        }
+    }
+    if(!write_wav(path, out)) {
+        printf("ERR: couldn't write %s\n", path);
+        return 1;
+    }
+    printf("rendered %.1f s to %s, up to %u voices, %u stolen\n", length_s, path, max_voices, synth.stolen);
+
+    // every voice held for the whole run, release never starts so the count stays put
+    SynthCore<SYNTH_VOICES> bench;
+    bench.configure(SAMPLE_RATE, {});
+    for(uint8_t i = 0; i < SYNTH_VOICES; i++) bench.note_on(36 + i * 3, 255);
+    constexpr uint32_t BLOCKS = 20000;
+    uint64_t voice_blocks = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < BLOCKS; i++) voice_blocks += bench.render(buf, BLOCK);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    const double block_ms = BLOCK * 1000.0 / SAMPLE_RATE;
+    const double voice_blocks_per_ms = voice_blocks / ms;
+    printf("%u blocks of %u voices in %.1f ms: %.1f voice blocks per ms, %.0f voices in real time\n",
+        BLOCKS, SYNTH_VOICES, ms, voice_blocks_per_ms, voice_blocks_per_ms * block_ms);
+    return 0;
+}
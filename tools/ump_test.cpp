@@ -0,0 +1,142 @@
+// the ump encoder/decoder (src/midi/ump.cpp): packet layout against the midi 2.0 spec, a
+// randomized encode -> decode round trip of every op, and what each op translates to in midi 1.0
+//
+//   g++ -std=gnu++17 -O2 -Wall -Wextra -Isrc -Itools tools/ump_test.cpp src/midi/ump.cpp -o ump_test
+//   ./ump_test
+
+#include <random>
+#include <vector>
+#include "host_check.hpp"
+#include "midi/ump.hpp"
+
+static bool is_note(const UmpOp op) {
+    return op == UmpOp::note_on || op == UmpOp::note_off;
+}
+
+static void layout() {
+    // note on, group 1, channel 3, note 60, attribute type 3 (pitch 7.9), velocity 0xABCD
+    const auto p = ump_encode({ UmpOp::note_on, 1, 2, 60, 3, 0xABCD, 0x1234 });
+    CHECK_EQ(p.words[0], 0x41923C03);
+    CHECK_EQ(p.words[1], 0xABCD1234);
+    CHECK_EQ(ump_word_count(p.words[0]), 2);
+
+    // a 32 bit controller keeps the whole value, and nothing spills out of the 4 bit fields
+    const auto cc = ump_encode({ UmpOp::control_change, 0x1F, 0x1F, 7, 0, 0xFEDCBA98, 0 });
+    CHECK_EQ(cc.words[0], 0x4FBF0700);
+    CHECK_EQ(cc.words[1], 0xFEDCBA98);
+
+    // the velocity only takes the top half, the attribute the bottom
+    const auto off = ump_encode({ UmpOp::note_off, 0, 0, 1, 0, 0x12345678, 0xFFFF });
+    CHECK_EQ(off.words[1], 0x5678FFFF);
+
+    CHECK_EQ(ump_velocity(0), 0);
+    CHECK_EQ(ump_velocity(0x80), 0x8080);
+    CHECK_EQ(ump_velocity(255), 0xFFFF);
+}
+
+static void round_trip() {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<uint32_t> word;
+    for(uint8_t op = 0; op < 16; op++) {
+        for(uint16_t i = 0; i < 1000; i++) {
+            const uint32_t r = word(rng);
+            UmpMessage m = { static_cast<UmpOp>(op), static_cast<uint8_t>(r & 0xF), static_cast<uint8_t>(r >> 4 & 0xF),
+                static_cast<uint8_t>(r >> 8), static_cast<uint8_t>(r >> 16), word(rng), static_cast<uint16_t>(word(rng)) };
+            if(is_note(m.op)) {
+                m.value &= 0xFFFF;
+            } else {
+                m.attribute = 0;
+            }
+            const auto p = ump_encode(m);
+            UmpMessage d;
+            const bool ok = ump_decode(p.words, d);
+            if(op == 0x7) {
+                CHECK(!ok); // undefined
+                break;
+            }
+            CHECK(ok);
+            CHECK_EQ(static_cast<uint8_t>(d.op), op);
+            CHECK_EQ(d.group, m.group);
+            CHECK_EQ(d.channel, m.channel);
+            CHECK_EQ(d.index, m.index);
+            CHECK_EQ(d.index2, m.index2);
+            CHECK_EQ(d.value, m.value);
+            CHECK_EQ(d.attribute, m.attribute);
+        }
+    }
+
+    // other message types aren't ours to decode
+    UmpMessage d;
+    const uint32_t midi1_voice[2] = { 0x20903C40, 0 };
+    CHECK(!ump_decode(midi1_voice, d));
+    const uint32_t sysex7[2] = { 0x30050102, 0x03040500 };
+    CHECK(!ump_decode(sysex7, d));
+}
+
+struct Midi1 {
+    uint8_t status, data1, data2;
+    bool operator==(const Midi1& o) const { return status == o.status && data1 == o.data1 && data2 == o.data2; }
+};
+
+static std::vector<Midi1> translate(const UmpMessage& m) {
+    std::vector<Midi1> out;
+    const uint8_t n = ump_to_midi1(m, [&](const uint8_t status, const uint8_t data1, const uint8_t data2) {
+        out.push_back({ status, data1, data2 });
+    });
+    CHECK_EQ(n, out.size());
+    CHECK(n <= UMP_MIDI1_MAX);
+    return out;
+}
+
+static void to_midi1() {
+    using V = std::vector<Midi1>;
+    // 16 bit velocity -> 14 bits, the low 7 in the high resolution velocity prefix
+    CHECK((translate({ UmpOp::note_on, 0, 2, 60, 0, 0xABCD, 0 }) == V{ { 0xB2, 0x58, 0x73 }, { 0x92, 60, 0x55 } }));
+    // nothing in the low bits, no prefix
+    CHECK((translate({ UmpOp::note_on, 0, 0, 60, 0, ump_velocity(0x80) & 0xFE00, 0 }) == V{ { 0x90, 60, 0x40 } }));
+    // too quiet for midi 1.0 still isn't a note off
+    CHECK((translate({ UmpOp::note_on, 0, 0, 60, 0, 0x0004, 0 }) == V{ { 0xB0, 0x58, 0x01 }, { 0x90, 60, 1 } }));
+    CHECK((translate({ UmpOp::note_on, 0, 0, 60, 0, 0, 0 }) == V{ { 0x90, 60, 1 } }));
+    // note offs never get a prefix, and can be 0
+    CHECK((translate({ UmpOp::note_off, 0, 15, 61, 0, 0xABCD, 0 }) == V{ { 0x8F, 61, 0x55 } }));
+    CHECK((translate({ UmpOp::note_off, 0, 0, 61, 0, 0, 0 }) == V{ { 0x80, 61, 0 } }));
+
+    CHECK((translate({ UmpOp::poly_pressure, 0, 1, 62, 0, 0x80000000, 0 }) == V{ { 0xA1, 62, 0x40 } }));
+    CHECK((translate({ UmpOp::control_change, 0, 1, 74, 0, 0xFFFFFFFF, 0 }) == V{ { 0xB1, 74, 0x7F } }));
+    CHECK((translate({ UmpOp::channel_pressure, 0, 1, 0, 0, 0x20000000, 0 }) == V{ { 0xD1, 0x10, 0 } }));
+    // centred, and the top 14 bits lsb first
+    CHECK((translate({ UmpOp::pitch_bend, 0, 0, 0, 0, 0x80000000, 0 }) == V{ { 0xE0, 0x00, 0x40 } }));
+    CHECK((translate({ UmpOp::pitch_bend, 0, 0, 0, 0, 0x12345678, 0 }) == V{ { 0xE0, 0x0D, 0x09 } }));
+
+    // bank select only when it's valid
+    CHECK((translate({ UmpOp::program_change, 0, 3, 0, 0, 5u << 24 | 0x12 << 8 | 0x34, 0 }) == V{ { 0xC3, 5, 0 } }));
+    CHECK((translate({ UmpOp::program_change, 0, 3, 0, 1, 5u << 24 | 0x12 << 8 | 0x34, 0 })
+        == V{ { 0xB3, 0, 0x12 }, { 0xB3, 32, 0x34 }, { 0xC3, 5, 0 } }));
+
+    // rpn/nrpn select then data entry msb/lsb, 14 bits
+    CHECK((translate({ UmpOp::registered_controller, 0, 0, 0, 0, 0x0C000000, 0 })
+        == V{ { 0xB0, 101, 0 }, { 0xB0, 100, 0 }, { 0xB0, 6, 0x06 }, { 0xB0, 38, 0 } }));
+    CHECK((translate({ UmpOp::assignable_controller, 0, 4, 1, 2, 0xFFFFFFFF, 0 })
+        == V{ { 0xB4, 99, 1 }, { 0xB4, 98, 2 }, { 0xB4, 6, 0x7F }, { 0xB4, 38, 0x7F } }));
+
+    // nothing to translate to
+    for(const auto op : { UmpOp::registered_per_note_controller, UmpOp::assignable_per_note_controller,
+            UmpOp::relative_registered_controller, UmpOp::relative_assignable_controller,
+            UmpOp::per_note_pitch_bend, UmpOp::per_note_management }) {
+        CHECK(translate({ op, 0, 0, 60, 1, 0x80000000, 0 }).empty());
+    }
+
+    // and the status nibble always matches the op for everything that does translate
+    for(uint8_t op = 0x8; op <= 0xE; op++) {
+        const auto out = translate({ static_cast<UmpOp>(op), 0, 9, 60, 0, 0xFFFFFFFF, 0 });
+        CHECK(!out.empty());
+        CHECK_EQ(out.back().status, op << 4 | 9);
+    }
+}
+
+int main() {
+    layout();
+    round_trip();
+    to_midi1();
+    return check_exit("ump");
+}